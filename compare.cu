@@ -27,35 +27,577 @@
  * either expressed or implied, of the FreeBSD Project.
  */
 
+
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#if __CUDACC_VER_MAJOR__ >= 12
+#include <cuda_fp8.h>
+#endif
+
 // Actually, there are no rounding errors due to results being accumulated in an arbitrary order..
 // Therefore EPSILON = 0.0f is OK
 #define EPSILON 0.001f
 #define EPSILOND 0.0000001
+// Half and bfloat16 results are compared in float.  Repeated GEMMs are still
+// bit-identical, so these only need to stay below an ulp of typical values.
+#define EPSILONH 0.001f
+#define EPSILONBF 0.01f
+
+// Each round the compare kernels log their first FAULT_LOG_SIZE mismatches
+// next to the count, for the driver to read back with it.  FaultLog in
+// gpu_burn-drv.cpp has to have the same layout.
+#define FAULT_LOG_SIZE 64
+
+struct FaultRecord {
+	unsigned long long index;    // Element within the slice
+	unsigned long long expected; // Bits of the element in slice 0
+	unsigned long long got;
+	unsigned long long time;     // %globaltimer, in ns
+	unsigned int slice;
+	unsigned int sm;
+};
+
+struct FaultLog {
+	int faultyElems;
+	unsigned int logged; // May go past FAULT_LOG_SIZE
+	FaultRecord records[FAULT_LOG_SIZE];
+};
+
+template <class T> __device__ __forceinline__ unsigned long long bitsOf(T v) {
+	unsigned long long bits = 0;
+	memcpy(&bits, &v, sizeof(T));
+	return bits;
+}
+
+template <class T> __device__ void logFault(FaultLog *log, size_t slice,
+		size_t index, T expected, T got) {
+	// Don't have every thread hammer the counter when a whole slice is off
+	if (*(volatile unsigned int *)&log->logged >= FAULT_LOG_SIZE)
+		return;
+	unsigned int slot = atomicAdd(&log->logged, 1);
+	if (slot >= FAULT_LOG_SIZE)
+		return;
+	FaultRecord &r = log->records[slot];
+	r.index = index;
+	r.expected = bitsOf(expected);
+	r.got = bitsOf(got);
+	asm volatile("mov.u64 %0, %%globaltimer;" : "=l"(r.time));
+	r.slice = (unsigned int)slice;
+	asm("mov.u32 %0, %%smid;" : "=r"(r.sm));
+}
+
+__device__ __forceinline__ bool differs(float a, float b) {
+	return fabsf(a - b) > EPSILON;
+}
+
+__device__ __forceinline__ bool differs(double a, double b) {
+	return fabs(a - b) > EPSILOND;
+}
+
+__device__ __forceinline__ bool differs(__half a, __half b) {
+	return fabsf(__half2float(a) - __half2float(b)) > EPSILONH;
+}
+
+__device__ __forceinline__ bool differs(__nv_bfloat16 a, __nv_bfloat16 b) {
+	return fabsf(__bfloat162float(a) - __bfloat162float(b)) > EPSILONBF;
+}
 
-extern "C" __global__ void compare(float *C, int *faultyElems, size_t iters) {
-	size_t iterStep = blockDim.x*blockDim.y*gridDim.x*gridDim.y;
+// The grid may be rounded up past the iterStep elements of each result slice
+template <class T> __device__ void compareImpl(T *C, FaultLog *log,
+		size_t iters, size_t iterStep) {
 	size_t myIndex = (blockIdx.y*blockDim.y + threadIdx.y)* // Y
 		gridDim.x*blockDim.x + // W
 		blockIdx.x*blockDim.x + threadIdx.x; // X
+	if (myIndex >= iterStep)
+		return;
 
 	int myFaulty = 0;
 	for (size_t i = 1; i < iters; ++i)
-		if (fabsf(C[myIndex] - C[myIndex + i*iterStep]) > EPSILON)
+		if (differs(C[myIndex], C[myIndex + i*iterStep])) {
 			myFaulty++;
+			logFault(log, i, myIndex, C[myIndex], C[myIndex + i*iterStep]);
+		}
 
-	atomicAdd(faultyElems, myFaulty);
+	atomicAdd(&log->faultyElems, myFaulty);
 }
 
-extern "C" __global__ void compareD(double *C, int *faultyElems, size_t iters) {
-	size_t iterStep = blockDim.x*blockDim.y*gridDim.x*gridDim.y;
-	size_t myIndex = (blockIdx.y*blockDim.y + threadIdx.y)* // Y
-		gridDim.x*blockDim.x + // W
-		blockIdx.x*blockDim.x + threadIdx.x; // X
+extern "C" __global__ void compare(float *C, FaultLog *log, size_t iters,
+		size_t iterStep) {
+	compareImpl(C, log, iters, iterStep);
+}
+
+extern "C" __global__ void compareD(double *C, FaultLog *log, size_t iters,
+		size_t iterStep) {
+	compareImpl(C, log, iters, iterStep);
+}
+
+extern "C" __global__ void compareH(__half *C, FaultLog *log, size_t iters,
+		size_t iterStep) {
+	compareImpl(C, log, iters, iterStep);
+}
+
+extern "C" __global__ void compareBF(__nv_bfloat16 *C, FaultLog *log,
+		size_t iters, size_t iterStep) {
+	compareImpl(C, log, iters, iterStep);
+}
+
+// Counter-based generator (Philox4x32-10) for filling A and B on the device.
+// Every group of four elements is a pure function of (seed, matrix, index),
+// so the result is reproducible regardless of the launch geometry.
+__device__ __forceinline__ uint4 philox4x32(uint4 ctr, uint2 key) {
+	for (int r = 0; r < 10; ++r) {
+		unsigned int hi0 = __umulhi(0xD2511F53u, ctr.x);
+		unsigned int lo0 = 0xD2511F53u*ctr.x;
+		unsigned int hi1 = __umulhi(0xCD9E8D57u, ctr.z);
+		unsigned int lo1 = 0xCD9E8D57u*ctr.z;
+		ctr = make_uint4(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+		key.x += 0x9E3779B9u;
+		key.y += 0xBB67AE85u;
+	}
+	return ctr;
+}
+
+// Same value range as the old host-side rand() fill: [0, 10) in steps of 1e-5
+__device__ __forceinline__ double randomValue(unsigned int r) {
+	return (double)(r % 1000000) / 100000.0;
+}
+
+// The low precision types get [-1, 1) instead, so that the k-long sums stay
+// well within their range
+template <class T> __device__ void initMatrixImpl(T *M, size_t elems,
+		unsigned long long seed, unsigned int matrix, double scale = 1.0,
+		double offset = 0.0) {
+	uint2 key = make_uint2((unsigned int)seed, (unsigned int)(seed >> 32));
+	size_t groups = (elems + 3)/4;
+	for (size_t g = blockIdx.x*blockDim.x + threadIdx.x; g < groups;
+			g += blockDim.x*gridDim.x) {
+		uint4 r = philox4x32(make_uint4((unsigned int)g,
+					(unsigned int)(g >> 32), matrix, 0), key);
+		size_t i = g*4;
+		M[i] = (T)(randomValue(r.x)*scale + offset);
+		if (i + 1 < elems) M[i + 1] = (T)(randomValue(r.y)*scale + offset);
+		if (i + 2 < elems) M[i + 2] = (T)(randomValue(r.z)*scale + offset);
+		if (i + 3 < elems) M[i + 3] = (T)(randomValue(r.w)*scale + offset);
+	}
+}
+
+extern "C" __global__ void initMatrix(float *M, size_t elems,
+		unsigned long long seed, unsigned int matrix) {
+	initMatrixImpl(M, elems, seed, matrix);
+}
+
+extern "C" __global__ void initMatrixD(double *M, size_t elems,
+		unsigned long long seed, unsigned int matrix) {
+	initMatrixImpl(M, elems, seed, matrix);
+}
+
+extern "C" __global__ void initMatrixH(__half *M, size_t elems,
+		unsigned long long seed, unsigned int matrix) {
+	initMatrixImpl(M, elems, seed, matrix, 0.2, -1.0);
+}
+
+extern "C" __global__ void initMatrixBF(__nv_bfloat16 *M, size_t elems,
+		unsigned long long seed, unsigned int matrix) {
+	initMatrixImpl(M, elems, seed, matrix, 0.2, -1.0);
+}
+
+#if __CUDACC_VER_MAJOR__ >= 12
+extern "C" __global__ void initMatrixF8(__nv_fp8_e4m3 *M, size_t elems,
+		unsigned long long seed, unsigned int matrix) {
+	initMatrixImpl(M, elems, seed, matrix, 0.2, -1.0);
+}
+#endif
 
+// Compares result slices C[0..slices) against the first one.  Used by the
+// pipelined mode, where each slice is checked as soon as its GEMM has
+// finished.  C is slice number firstSlice, for the fault log.
+template <class T> __device__ void compareSliceImpl(const T *C0, const T *C,
+		FaultLog *log, size_t elems, size_t slices, size_t firstSlice) {
 	int myFaulty = 0;
-	for (size_t i = 1; i < iters; ++i)
-		if (fabs(C[myIndex] - C[myIndex + i*iterStep]) > EPSILOND)
+	for (size_t i = blockIdx.x*blockDim.x + threadIdx.x; i < elems;
+			i += blockDim.x*gridDim.x)
+		for (size_t s = 0; s < slices; ++s)
+			if (differs(C0[i], C[i + s*elems])) {
+				myFaulty++;
+				logFault(log, firstSlice + s, i, C0[i], C[i + s*elems]);
+			}
+
+	if (myFaulty)
+		atomicAdd(&log->faultyElems, myFaulty);
+}
+
+extern "C" __global__ void compareSlice(float *C0, float *C, FaultLog *log,
+		size_t elems, size_t slices, size_t firstSlice) {
+	compareSliceImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+extern "C" __global__ void compareSliceD(double *C0, double *C,
+		FaultLog *log, size_t elems, size_t slices, size_t firstSlice) {
+	compareSliceImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+extern "C" __global__ void compareSliceH(__half *C0, __half *C,
+		FaultLog *log, size_t elems, size_t slices, size_t firstSlice) {
+	compareSliceImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+extern "C" __global__ void compareSliceBF(__nv_bfloat16 *C0, __nv_bfloat16 *C,
+		FaultLog *log, size_t elems, size_t slices, size_t firstSlice) {
+	compareSliceImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+// Vectorized variant of the above: every thread loads 16 bytes at a time from
+// each slice, the counts are reduced within each warp with shuffles and each
+// block does a single atomic.  Compares slices C[0..slices) against C0.
+template <class T> __device__ __forceinline__ int countFaulty(uint4 a,
+		uint4 b, FaultLog *log, size_t slice, size_t index) {
+	const T *x = (const T *)&a;
+	const T *y = (const T *)&b;
+	int faulty = 0;
+#pragma unroll
+	for (int i = 0; i < (int)(sizeof(uint4)/sizeof(T)); ++i)
+		if (differs(x[i], y[i])) {
+			faulty++;
+			logFault(log, slice, index + i, x[i], y[i]);
+		}
+	return faulty;
+}
+
+__device__ __forceinline__ void blockAddFaulty(int *faultyElems, int myFaulty) {
+	__shared__ int warpFaulty[32];
+
+	for (int offset = 16; offset > 0; offset /= 2)
+		myFaulty += __shfl_down_sync(0xffffffff, myFaulty, offset);
+	if ((threadIdx.x & 31) == 0)
+		warpFaulty[threadIdx.x >> 5] = myFaulty;
+	__syncthreads();
+
+	if (threadIdx.x < 32) {
+		myFaulty = threadIdx.x < (blockDim.x >> 5) ? warpFaulty[threadIdx.x] : 0;
+		for (int offset = 16; offset > 0; offset /= 2)
+			myFaulty += __shfl_down_sync(0xffffffff, myFaulty, offset);
+		if (threadIdx.x == 0 && myFaulty)
+			atomicAdd(faultyElems, myFaulty);
+	}
+}
+
+template <class T> __device__ void compareVecImpl(const T *C0, const T *C,
+		FaultLog *log, size_t elems, size_t slices, size_t firstSlice) {
+	const size_t perVec = sizeof(uint4)/sizeof(T);
+	// Slices are only 16-byte aligned if their size is a multiple of that
+	size_t vecs = (elems % perVec) ? 0 : elems/perVec;
+	size_t tid = blockIdx.x*blockDim.x + threadIdx.x;
+	size_t stride = blockDim.x*gridDim.x;
+
+	int myFaulty = 0;
+	for (size_t i = tid; i < vecs; i += stride) {
+		uint4 ref = ((const uint4 *)C0)[i];
+		for (size_t s = 0; s < slices; ++s)
+			myFaulty += countFaulty<T>(ref, ((const uint4 *)(C + s*elems))[i],
+					log, firstSlice + s, i*perVec);
+	}
+	for (size_t i = vecs*perVec + tid; i < elems; i += stride)
+		for (size_t s = 0; s < slices; ++s)
+			if (differs(C0[i], C[i + s*elems])) {
+				myFaulty++;
+				logFault(log, firstSlice + s, i, C0[i], C[i + s*elems]);
+			}
+
+	blockAddFaulty(&log->faultyElems, myFaulty);
+}
+
+extern "C" __global__ void compareVec(float *C0, float *C, FaultLog *log,
+		size_t elems, size_t slices, size_t firstSlice) {
+	compareVecImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+extern "C" __global__ void compareVecD(double *C0, double *C, FaultLog *log,
+		size_t elems, size_t slices, size_t firstSlice) {
+	compareVecImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+extern "C" __global__ void compareVecH(__half *C0, __half *C, FaultLog *log,
+		size_t elems, size_t slices, size_t firstSlice) {
+	compareVecImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+extern "C" __global__ void compareVecBF(__nv_bfloat16 *C0, __nv_bfloat16 *C,
+		FaultLog *log, size_t elems, size_t slices, size_t firstSlice) {
+	compareVecImpl(C0, C, log, elems, slices, firstSlice);
+}
+
+// Memory burn (--mem): every 16 bytes of the buffer get a value that is a
+// function of their index and the pass, so they can be checked without a
+// reference copy.  A pass writes the pattern, checks it while writing its
+// inverse, and checks the inverse.  Patterns are 0 walking ones, 1 moving
+// inversions and 2 random.
+__device__ __forceinline__ uint4 memPattern(int pattern, size_t v,
+		unsigned int pass, unsigned long long seed) {
+	if (pattern == 2)
+		return philox4x32(make_uint4((unsigned int)v, (unsigned int)(v >> 32),
+					pass, 1), make_uint2((unsigned int)seed,
+					(unsigned int)(seed >> 32)));
+	if (pattern == 1) {
+		// A bit moving within each byte from pass to pass
+		unsigned int p = 0x01010101u << (pass & 7);
+		return make_uint4(p, p, p, p);
+	}
+	unsigned int s = (unsigned int)(v*4) + pass;
+	return make_uint4(1u << (s & 31), 1u << ((s + 1) & 31),
+			1u << ((s + 2) & 31), 1u << ((s + 3) & 31));
+}
+
+__device__ __forceinline__ uint4 invert(uint4 a) {
+	return make_uint4(~a.x, ~a.y, ~a.z, ~a.w);
+}
+
+__device__ __forceinline__ int countWrong(uint4 a, uint4 b) {
+	return (a.x != b.x) + (a.y != b.y) + (a.z != b.z) + (a.w != b.w);
+}
+
+extern "C" __global__ void memWrite(uint4 *buf, size_t vecs, int pattern,
+		unsigned int pass, unsigned long long seed) {
+	for (size_t v = blockIdx.x*blockDim.x + threadIdx.x; v < vecs;
+			v += blockDim.x*gridDim.x)
+		buf[v] = memPattern(pattern, v, pass, seed);
+}
+
+// Writes the inverse of what was expected rather than of what was read, so
+// that an error isn't counted twice
+extern "C" __global__ void memInvert(uint4 *buf, size_t vecs, int pattern,
+		unsigned int pass, unsigned long long seed, int *faultyElems) {
+	int myFaulty = 0;
+	for (size_t v = blockIdx.x*blockDim.x + threadIdx.x; v < vecs;
+			v += blockDim.x*gridDim.x) {
+		uint4 expected = memPattern(pattern, v, pass, seed);
+		myFaulty += countWrong(buf[v], expected);
+		buf[v] = invert(expected);
+	}
+	blockAddFaulty(faultyElems, myFaulty);
+}
+
+extern "C" __global__ void memCheck(const uint4 *buf, size_t vecs,
+		int pattern, unsigned int pass, unsigned long long seed,
+		int *faultyElems) {
+	int myFaulty = 0;
+	for (size_t v = blockIdx.x*blockDim.x + threadIdx.x; v < vecs;
+			v += blockDim.x*gridDim.x)
+		myFaulty += countWrong(buf[v], invert(memPattern(pattern, v, pass,
+						seed)));
+	blockAddFaulty(faultyElems, myFaulty);
+}
+
+// --compare checksum: instead of comparing every element against slice 0,
+// each slice is reduced to one sum per column, and the sums are checked
+// against slice 0's and against the reference the host worked out from A
+// and B.  One warp does a column, always in the same order, so identical
+// slices give identical sums.  C is column major and starts at slice
+// firstSlice.
+__device__ __forceinline__ double toDouble(double v) { return v; }
+__device__ __forceinline__ double toDouble(float v) { return v; }
+__device__ __forceinline__ double toDouble(__half v) {
+	return __half2float(v);
+}
+__device__ __forceinline__ double toDouble(__nv_bfloat16 v) {
+	return __bfloat162float(v);
+}
+
+template <class T> __device__ void columnSumsImpl(const T *C, double *sums,
+		size_t m, size_t n, size_t slices, size_t firstSlice) {
+	const unsigned int lane = threadIdx.x & 31;
+	size_t warps = (blockDim.x*gridDim.x) >> 5;
+	for (size_t col = (blockIdx.x*blockDim.x + threadIdx.x) >> 5;
+			col < n*slices; col += warps) {
+		const T *c = C + col*m;
+		double sum = 0.0;
+		for (size_t i = lane; i < m; i += 32)
+			sum += toDouble(c[i]);
+		for (int offset = 16; offset > 0; offset /= 2)
+			sum += __shfl_down_sync(0xffffffff, sum, offset);
+		if (lane == 0)
+			sums[firstSlice*n + col] = sum;
+	}
+}
+
+extern "C" __global__ void columnSums(const float *C, double *sums, size_t m,
+		size_t n, size_t slices, size_t firstSlice) {
+	columnSumsImpl(C, sums, m, n, slices, firstSlice);
+}
+
+extern "C" __global__ void columnSumsD(const double *C, double *sums,
+		size_t m, size_t n, size_t slices, size_t firstSlice) {
+	columnSumsImpl(C, sums, m, n, slices, firstSlice);
+}
+
+extern "C" __global__ void columnSumsH(const __half *C, double *sums,
+		size_t m, size_t n, size_t slices, size_t firstSlice) {
+	columnSumsImpl(C, sums, m, n, slices, firstSlice);
+}
+
+extern "C" __global__ void columnSumsBF(const __nv_bfloat16 *C, double *sums,
+		size_t m, size_t n, size_t slices, size_t firstSlice) {
+	columnSumsImpl(C, sums, m, n, slices, firstSlice);
+}
+
+// A sum is off if it's further than refTol*refAbs from the reference (the
+// rounding GEMMs may do, refAbs being the sum of the absolute products), or
+// further than sliceTol from slice 0's.  Each one counts as one error.
+extern "C" __global__ void checkColumnSums(const double *sums,
+		const double *ref, const double *refAbs, FaultLog *log, size_t m,
+		size_t n, size_t slices, double refTol, double sliceTol) {
+	int myFaulty = 0;
+	for (size_t i = blockIdx.x*blockDim.x + threadIdx.x; i < n*slices;
+			i += blockDim.x*gridDim.x) {
+		size_t col = i % n;
+		if (fabs(sums[i] - ref[col]) > refTol*refAbs[col] ||
+				fabs(sums[i] - sums[col]) > sliceTol) {
 			myFaulty++;
+			logFault(log, i/n, col*m, ref[col], sums[i]);
+		}
+	}
+	blockAddFaulty(&log->faultyElems, myFaulty);
+}
+
+// --engine fma and mma: synthetic loads in place of the GEMM, which write
+// result slices of m*n elements for the compares to check against slice 0
+// as usual.  Both also have a known answer the host works out, and
+// engineCheck holds the start of slice 0 against it.  These have to match
+// gpu_burn-drv.cpp.
+#define FMA_CHAINS 8 // Independent ones per thread, to keep the pipes full
+#define FMA_STEPS 512
+#define MMA_TILES 4 // Of 16x8 accumulated at once by a warp
+#define MMA_STEPS 256
+
+// x = x*x + c, which is chaotic for these c, so that the bits keep
+// toggling, yet bounded, and exactly what std::fma gets on the host.
+// C[i] is the sum of FMA_CHAINS orbits from A[i] and B[i].
+template <class T> __device__ void fmaBurnImpl(const T *A, const T *B, T *C,
+		size_t elems, size_t aElems, size_t bElems) {
+	for (size_t i = blockIdx.x*blockDim.x + threadIdx.x; i < elems;
+			i += blockDim.x*gridDim.x) {
+		T c = fma(A[i % aElems], (T)-0.04, (T)-1.5);
+		T x[FMA_CHAINS];
+#pragma unroll
+		for (int j = 0; j < FMA_CHAINS; ++j)
+			x[j] = fma(B[i % bElems], (T)0.1, (T)(j/32.0 - 0.5));
+		for (int s = 0; s < FMA_STEPS; ++s)
+#pragma unroll
+			for (int j = 0; j < FMA_CHAINS; ++j)
+				x[j] = fma(x[j], x[j], c);
+		T sum = x[0];
+#pragma unroll
+		for (int j = 1; j < FMA_CHAINS; ++j)
+			sum += x[j];
+		C[i] = sum;
+	}
+}
+
+extern "C" __global__ void fmaBurn(const float *A, const float *B, float *C,
+		size_t elems, size_t aElems, size_t bElems) {
+	fmaBurnImpl(A, B, C, elems, aElems, bElems);
+}
+
+extern "C" __global__ void fmaBurnD(const double *A, const double *B,
+		double *C, size_t elems, size_t aElems, size_t bElems) {
+	fmaBurnImpl(A, B, C, elems, aElems, bElems);
+}
+
+// [0, 10) to the integers in [-8, 8), which the tensor cores multiply and
+// add up exactly
+__device__ __forceinline__ int smallInt(float v) {
+	return (int)(v*1.6f) - 8;
+}
+
+__device__ __forceinline__ unsigned int smallInts(const float *M, size_t i,
+		size_t elems, bool negate) {
+	__half2 h = __halves2half2(__int2half_rn(smallInt(M[i % elems])),
+			__int2half_rn(smallInt(M[(i + 1) % elems])));
+	if (negate)
+		h = __hneg2(h);
+	return *(unsigned int *)&h;
+}
+
+__device__ __forceinline__ void mma16816(float *d, const unsigned int *a,
+		const unsigned int *b) {
+#if __CUDA_ARCH__ >= 800
+	asm volatile("mma.sync.aligned.m16n8k16.row.col.f32.f16.f16.f32 "
+			"{%0, %1, %2, %3}, {%4, %5, %6, %7}, {%8, %9}, "
+			"{%0, %1, %2, %3};"
+			: "+f"(d[0]), "+f"(d[1]), "+f"(d[2]), "+f"(d[3])
+			: "r"(a[0]), "r"(a[1]), "r"(a[2]), "r"(a[3]), "r"(b[0]),
+			"r"(b[1]));
+#endif
+}
+
+// m16n8k16 MMAs of fp16 inputs into fp32 accumulators.  Each step adds A*B
+// and then A*(-B), with two sets of fragments taking turns, so that the
+// accumulators come back to exactly what they started at whatever the
+// fragment layout is.  They start at smallInt(A[i]) for element i of the
+// slice, and that's the known answer.  The host has m*n be a multiple of
+// 128*MMA_TILES, and only runs this from compute capability 8.0 on.
+extern "C" __global__ void mmaBurn(const float *A, const float *B, float *C,
+		size_t elems, size_t aElems, size_t bElems) {
+	const unsigned int lane = threadIdx.x & 31;
+	size_t warps = (blockDim.x*gridDim.x) >> 5;
+	for (size_t t = (blockIdx.x*blockDim.x + threadIdx.x) >> 5;
+			t < elems/(128*MMA_TILES); t += warps) {
+		size_t frag = t*32 + lane;
+		unsigned int a[2][4], b[2][2], nb[2][2];
+#pragma unroll
+		for (int f = 0; f < 2; ++f) {
+#pragma unroll
+			for (int r = 0; r < 4; ++r)
+				a[f][r] = smallInts(A, (frag*2 + f)*8 + r*2, aElems, false);
+#pragma unroll
+			for (int r = 0; r < 2; ++r) {
+				b[f][r] = smallInts(B, (frag*2 + f)*4 + r*2, bElems, false);
+				nb[f][r] = smallInts(B, (frag*2 + f)*4 + r*2, bElems, true);
+			}
+		}
+
+		// Each lane has 4 accumulators of each tile
+		size_t first = t*128*MMA_TILES + lane*4;
+		float d[MMA_TILES][4];
+#pragma unroll
+		for (int u = 0; u < MMA_TILES; ++u)
+#pragma unroll
+			for (int r = 0; r < 4; ++r)
+				d[u][r] = smallInt(A[(first + u*128 + r) % aElems]);
+
+		for (int s = 0; s < MMA_STEPS; ++s)
+#pragma unroll
+			for (int u = 0; u < MMA_TILES; ++u) {
+				mma16816(d[u], a[s & 1], b[s & 1]);
+				mma16816(d[u], a[s & 1], nb[s & 1]);
+			}
+
+#pragma unroll
+		for (int u = 0; u < MMA_TILES; ++u)
+#pragma unroll
+			for (int r = 0; r < 4; ++r)
+				C[first + u*128 + r] = d[u][r];
+	}
+}
+
+// Holds the first count elements of slice 0 against the known answer
+template <class T> __device__ void engineCheckImpl(const T *C,
+		const T *expected, size_t count, FaultLog *log) {
+	int myFaulty = 0;
+	for (size_t i = blockIdx.x*blockDim.x + threadIdx.x; i < count;
+			i += blockDim.x*gridDim.x)
+		if (bitsOf(C[i]) != bitsOf(expected[i])) {
+			myFaulty++;
+			logFault(log, 0, i, expected[i], C[i]);
+		}
+	blockAddFaulty(&log->faultyElems, myFaulty);
+}
+
+extern "C" __global__ void engineCheck(const float *C, const float *expected,
+		size_t count, FaultLog *log) {
+	engineCheckImpl(C, expected, count, log);
+}
 
-	atomicAdd(faultyElems, myFaulty);
+extern "C" __global__ void engineCheckD(const double *C,
+		const double *expected, size_t count, FaultLog *log) {
+	engineCheckImpl(C, expected, count, log);
 }
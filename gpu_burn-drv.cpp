@@ -27,28 +27,36 @@
  *policies, either expressed or implied, of the FreeBSD Project.
  */
 
-// Matrices are SIZE*SIZE..  POT should be efficiently implemented in CUBLAS
+// Matrices are SIZE*SIZE by default..  POT should be efficiently implemented
+// in CUBLAS.  Other shapes can be picked with --size.
 #define SIZE 8192ul
 #define USEMEM 0.9 // Try to allocate 90% of memory
-#define COMPARE_KERNEL "compare.ptx"
-
-// Used to report op/s, measured through Visual Profiler, CUBLAS from CUDA 7.5
-// (Seems that they indeed take the naive dim^3 approach)
-//#define OPS_PER_MUL 17188257792ul // Measured for SIZE = 2048
-#define OPS_PER_MUL 1100048498688ul // Extrapolated for SIZE = 8192
+#define DEFAULT_SEED 10 // Seed for the A and B matrices, same as the old srand()
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdarg>
 #include <cstdio>
+#include <cmath>
 #include <cstring>
+#include <deque>
+#include <dlfcn.h>
 #include <errno.h>
 #include <exception>
+#include <fcntl.h>
 #include <fstream>
 #include <map>
+#include <mutex>
+#include <netdb.h>
+#include <numeric>
 #include <signal.h>
 #include <stdexcept>
 #include <string.h>
 #include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -57,12 +65,48 @@
 #include <unistd.h>
 #include <vector>
 #include <regex>
+#include <sched.h>
+#include <sys/syscall.h>
 
 #define SIGTERM_TIMEOUT_THRESHOLD_SECS 30 // number of seconds for sigterm to kill child processes before forcing a sigkill
+#define DEFAULT_SAMPLE_MS 100 // NVML sampling period
+#define SLOT_POLL_MS 100 // How often the monitor looks at the --threads slots
+#define P2P_MB 64 // Size of each --p2p transfer
+#define PCIE_MB 64 // Size of each --pcie transfer
+#define RESULT_CHUNK_MB 1024 // Of physical memory the results are mapped in
+#define LATENCY_SUB_BUCKETS 16 // Per power of two of the latency histograms
+#define LATENCY_SETS 4 // Rounds of --latency events in flight
+#define PROFILE_DEPTH 2 // GEMMs queued ahead of the --profile gate
+#define PROFILE_TICK 0.1 // Seconds of each square wave of the ramp
+#define PROFILE_RAMP_PHASES 10
+// Of the --engine kernels, which compare.cu has to match
+#define FMA_CHAINS 8
+#define FMA_STEPS 512
+#define MMA_TILES 4
+#define MMA_STEPS 256
+#define ENGINE_CHECKED 4096 // Elements of slice 0 held against the answer
+#define FAULT_LOG_SIZE 64 // Mismatches the compare kernels log per round
+#define FAULTS_KEPT 256 // Mismatches kept per GPU for the summary
+#define FAULTS_PRINTED 16
+#define DEFAULT_STABLE_WINDOW 30 // Seconds of --until-stable samples
+#define STABLE_TEMP_C 2 // How much the temperature may move when steady
+#define DEFAULT_SLOW_FRACTION 0.9 // Of the --baseline, below which it's slow
+#define MPOL_PREFERRED 1 // From linux/mempolicy.h, we don't need libnuma
+#define AGENT_CONNECT_S 60 // How long an --agent retries its coordinator
+#define COORDINATOR_JOIN_S 300 // How long the coordinator waits for agents
+#define COORDINATOR_LEAD_S 3 // From the last agent joining to the start
+#define COORDINATOR_SILENT_S 120 // Until an agent that says nothing is lost
+#define DAEMON_SUMMARY_S 600 // Between the summaries of a --daemon
 
+#include "cublasLt.h"
 #include "cublas_v2.h"
 #define CUDA_ENABLE_DEPRECATED
 #include <cuda.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#if CUDA_VERSION >= 12000
+#include <cuda_fp8.h>
+#endif
 
 void _checkError(int rCode, std::string file, int line, std::string desc = "") {
     if (rCode != CUDA_SUCCESS) {
@@ -103,28 +147,570 @@ double getTime() {
     return (double)t.tv_sec + (double)t.tv_usec / 1e6;
 }
 
+// The same clock for all processes of the node, which wall time isn't
+// when it's stepped
+double monotonicTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+// User + system time consumed so far
+double cpuSeconds(const struct rusage &usage) {
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
 bool g_running = false;
+// Set by SIGTERM and SIGINT in the --daemon monitor.  In --threads mode the
+// workers' handler takes SIGTERM over, and sets it too.
+volatile sig_atomic_t g_stopRequested = 0;
+
+// compare.cu built for all the GPUs we know of, linked in by the Makefile
+extern "C" const char _binary_compare_fatbin_start[];
+
+// Element types of A and B, see GemmTraits for the matching C++ types
+enum Precision { FP64, FP32, TF32, FP16, BF16, FP8 };
+const char *g_precisionNames[] = {"fp64", "fp32", "tf32", "fp16", "bf16", "fp8"};
+const char *g_precisionDescs[] = {"using DOUBLES", "using FLOATS",
+                                  "using TF32",    "using FP16",
+                                  "using BF16",    "using FP8"};
+
+// Per input type: the type cuBLAS knows it by, the type of the C slices it
+// is multiplied into, and the suffixes of the matching kernels in compare.cu
+template <class T> struct GemmTraits;
+template <> struct GemmTraits<double> {
+    typedef double Result;
+    static cudaDataType type() { return CUDA_R_64F; }
+    static cudaDataType resultType() { return CUDA_R_64F; }
+    static const char *initSuffix() { return "D"; }
+    static const char *compareSuffix() { return "D"; }
+    static double toDouble(double v) { return v; }
+    static double epsilon() { return 0.0000001; } // EPSILOND of compare.cu
+};
+template <> struct GemmTraits<float> {
+    typedef float Result;
+    static cudaDataType type() { return CUDA_R_32F; }
+    static cudaDataType resultType() { return CUDA_R_32F; }
+    static const char *initSuffix() { return ""; }
+    static const char *compareSuffix() { return ""; }
+    static double toDouble(float v) { return v; }
+    static double epsilon() { return 0.001; }
+};
+template <> struct GemmTraits<__half> {
+    typedef __half Result;
+    static cudaDataType type() { return CUDA_R_16F; }
+    static cudaDataType resultType() { return CUDA_R_16F; }
+    static const char *initSuffix() { return "H"; }
+    static const char *compareSuffix() { return "H"; }
+    static double toDouble(__half v) { return __half2float(v); }
+    static double epsilon() { return 0.001; }
+};
+template <> struct GemmTraits<__nv_bfloat16> {
+    typedef __nv_bfloat16 Result;
+    static cudaDataType type() { return CUDA_R_16BF; }
+    static cudaDataType resultType() { return CUDA_R_16BF; }
+    static const char *initSuffix() { return "BF"; }
+    static const char *compareSuffix() { return "BF"; }
+    static double toDouble(__nv_bfloat16 v) { return __bfloat162float(v); }
+    static double epsilon() { return 0.01; }
+};
+#if CUDA_VERSION >= 12000
+// cublasLt doesn't write FP8 results without scaling, bfloat16 it is
+template <> struct GemmTraits<__nv_fp8_e4m3> {
+    typedef __nv_bfloat16 Result;
+    static cudaDataType type() { return CUDA_R_8F_E4M3; }
+    static cudaDataType resultType() { return CUDA_R_16BF; }
+    static const char *initSuffix() { return "F8"; }
+    static const char *compareSuffix() { return "BF"; }
+    static double toDouble(__nv_fp8_e4m3 v) { return (float)v; }
+    static double epsilon() { return 0.01; }
+};
+#endif
+
+// Patterns of the memory burn, numbered as memPattern() in compare.cu
+enum MemPattern { MEM_NONE = -1, MEM_WALKING, MEM_INVERSIONS, MEM_RANDOM };
+const char *g_memPatternNames[] = {"walking", "inversions", "random"};
+
+// The mismatches the compare kernels log each round, laid out as in
+// compare.cu
+struct FaultRecord {
+    unsigned long long index;    // Element within the slice
+    unsigned long long expected; // Bits of the element in slice 0
+    unsigned long long got;
+    unsigned long long time; // %globaltimer, in ns
+    unsigned int slice;
+    unsigned int sm;
+};
+
+struct FaultLog {
+    int faultyElems;
+    unsigned int logged; // May go past FAULT_LOG_SIZE
+    FaultRecord records[FAULT_LOG_SIZE];
+};
+
+// --fail-fast stops a GPU at its first error, or all of them
+enum FailFast { FAIL_FAST_OFF, FAIL_FAST_GPU, FAIL_FAST_ALL };
+
+// What computes the result slices: the GEMM, or the synthetic loads of
+// compare.cu on the FMA pipes or the tensor cores
+enum Engine { ENGINE_CUBLAS, ENGINE_FMA, ENGINE_MMA };
+const char *g_engineNames[] = {"cublas", "fma", "mma"};
+
+// The known answers of the --engine kernels, see fmaBurn and mmaBurn in
+// compare.cu.  Only float and double have engines.
+template <class V> V fmaAnswer(V a, V b) {
+    V c = std::fma(a, (V)-0.04, (V)-1.5);
+    V x[FMA_CHAINS];
+    for (int j = 0; j < FMA_CHAINS; ++j)
+        x[j] = std::fma(b, (V)0.1, (V)(j / 32.0 - 0.5));
+    for (int s = 0; s < FMA_STEPS; ++s)
+        for (int j = 0; j < FMA_CHAINS; ++j)
+            x[j] = std::fma(x[j], x[j], c);
+    V sum = x[0];
+    for (int j = 1; j < FMA_CHAINS; ++j)
+        sum += x[j];
+    return sum;
+}
+
+float engineAnswer(Engine engine, float a, float b) {
+    if (engine == ENGINE_MMA)
+        return (float)((int)(a * 1.6f) - 8);
+    return fmaAnswer(a, b);
+}
+double engineAnswer(Engine engine, double a, double b) {
+    if (engine == ENGINE_MMA)
+        throw std::runtime_error("No mma engine answer for doubles");
+    return fmaAnswer(a, b);
+}
+// main() only runs the engines in fp32 and fp64.  The other precisions
+// have no answer to check against, rather than a wrong one.
+template <class V> V engineAnswer(Engine engine, V, V) {
+    throw std::runtime_error(std::string("No ") + g_engineNames[engine] +
+                             " engine answer for this precision");
+}
+
+// Which peers each GPU sends to in the --p2p mode
+enum P2PPattern { P2P_NONE = -1, P2P_RING, P2P_ALL };
+const char *g_p2pPatternNames[] = {"ring", "all"};
+
+// When --profile runs the GEMMs.  Times are of monotonicTime(), from an
+// epoch the parent picks before starting the workers, so that the load
+// steps of all GPUs line up.
+enum ProfileShape { PROFILE_FLAT = -1, PROFILE_SQUARE, PROFILE_RAMP, PROFILE_BURST };
+const char *g_profileNames[] = {"square", "ramp", "burst"};
+
+struct LoadProfile {
+    ProfileShape shape = PROFILE_FLAT;
+    double period = 1.0; // s
+    double duty = 0.5;   // Of a period of the square wave or the bursts
+    double epoch = 0.0;
+    unsigned long long seed = DEFAULT_SEED; // Of the bursts
+
+    bool on(double t) const {
+        double since = t - epoch;
+        switch (shape) {
+        case PROFILE_SQUARE:
+            return fmod(since, period) < duty * period;
+        case PROFILE_RAMP:
+            // Square waves of PROFILE_TICK, their duty going from 0 to 1
+            // over the period
+            return fmod(since, PROFILE_TICK) < rampDuty(since) * PROFILE_TICK;
+        case PROFILE_BURST:
+            // Periods picked at random, the same ones on every GPU
+            return burstOn((unsigned long long)(since / period));
+        default:
+            return true;
+        }
+    }
+
+    // What the throughput and power are reported by: off and on, or the
+    // tenth of the duty of the ramp
+    int phases() const {
+        return shape == PROFILE_RAMP ? PROFILE_RAMP_PHASES : 2;
+    }
+    int phase(double t) const {
+        if (shape != PROFILE_RAMP)
+            return on(t);
+        return std::min((int)(rampDuty(t - epoch) * PROFILE_RAMP_PHASES),
+                        PROFILE_RAMP_PHASES - 1);
+    }
+    std::string phaseName(int p) const {
+        if (shape != PROFILE_RAMP)
+            return p ? "on" : "off";
+        char name[16];
+        snprintf(name, sizeof(name), "%d-%d%%", p * 100 / PROFILE_RAMP_PHASES,
+                 (p + 1) * 100 / PROFILE_RAMP_PHASES);
+        return name;
+    }
+
+  private:
+    double rampDuty(double since) const {
+        return fmod(since, period) / period;
+    }
+
+    // splitmix64 of the period, as a uniform number in [0, 1)
+    bool burstOn(unsigned long long tick) const {
+        unsigned long long z = seed + (tick + 1) * 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z ^= z >> 31;
+        return (z >> 11) * (1.0 / 9007199254740992.0) < duty;
+    }
+};
+
+// Traffic of a --p2p link from one GPU to another, as the sender saw it
+struct LinkStats {
+    double bytes = 0.0;   // Both ways
+    double seconds = 0.0; // GPU time of the copies
+    unsigned long long errors = 0;
+};
+
+// What the --p2p workers share: each member allocates a receive buffer for
+// every GPU that sends to it, and after an arrive() they all know each
+// other's contexts and buffers.  The buffers have to stay around until all
+// the senders are done with them, hence leave().
+struct P2PGroup {
+    P2PGroup(P2PPattern pattern, const std::vector<int> &devices)
+        : pattern(pattern), devices(devices), ctx(devices.size()),
+          recv(devices.size(), std::vector<CUdeviceptr>(devices.size())),
+          links(devices.size(), std::vector<LinkStats>(devices.size())),
+          arrivedBy(devices.size()), leftBy(devices.size()) {}
+
+    bool sends(size_t from, size_t to) const {
+        if (from == to)
+            return false;
+        return pattern == P2P_ALL || to == (from + 1) % devices.size();
+    }
+
+    int member(int device) const {
+        return std::find(devices.begin(), devices.end(), device) -
+               devices.begin();
+    }
+
+    void arrive(size_t m) {
+        std::unique_lock<std::mutex> lock(mutex);
+        arrivedBy.at(m) = true;
+        cv.notify_all();
+        cv.wait(lock, [this] { return all(arrivedBy); });
+    }
+
+    void leave(size_t m, std::chrono::seconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        leftBy.at(m) = true;
+        cv.notify_all();
+        cv.wait_for(lock, timeout, [this] { return all(leftBy); });
+    }
+
+    // A member that failed before arriving does so with a NULL context, and
+    // the others won't send to it.  Its buffers are never freed, so those
+    // who already do can carry on.
+    void fail(int device) {
+        size_t m = member(device);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!arrivedBy.at(m))
+            ctx.at(m) = NULL;
+        arrivedBy.at(m) = leftBy.at(m) = true;
+        cv.notify_all();
+    }
+
+    void addLink(size_t from, size_t to, double bytes, double seconds,
+                 unsigned long long errors) {
+        std::lock_guard<std::mutex> lock(mutex);
+        LinkStats &link = links.at(from).at(to);
+        link.bytes += bytes;
+        link.seconds += seconds;
+        link.errors += errors;
+    }
+
+    LinkStats link(size_t from, size_t to) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return links.at(from).at(to);
+    }
+
+    const P2PPattern pattern;
+    const std::vector<int> devices;       // Members by their CUDA ordinal
+    std::vector<CUcontext> ctx;           // [member]
+    std::vector<std::vector<CUdeviceptr> > recv; // [receiver][sender]
+
+  private:
+    std::vector<std::vector<LinkStats> > links; // [sender][receiver]
+    std::vector<bool> arrivedBy, leftBy;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    static bool all(const std::vector<bool> &flags) {
+        return std::find(flags.begin(), flags.end(), false) == flags.end();
+    }
+};
+
+// Latencies in microseconds in log-linear buckets, like an HDR histogram:
+// 1 us wide up to LATENCY_SUB_BUCKETS us, then LATENCY_SUB_BUCKETS buckets
+// per power of two.  A percentile is within 1/LATENCY_SUB_BUCKETS of the
+// true value.
+class LatencyHistogram {
+  public:
+    LatencyHistogram() : d_counts(64 * LATENCY_SUB_BUCKETS) {}
+
+    void add(double us) {
+        ++d_counts.at(bucket(us));
+        ++d_count;
+        d_max = std::max(d_max, us);
+    }
+
+    size_t count() const { return d_count; }
+    double max() const { return d_max; }
+
+    // The upper bound of the bucket with the p-th percentile, in us
+    double percentile(double p) const {
+        size_t rank = std::max((size_t)ceil(p / 100.0 * d_count), (size_t)1);
+        size_t seen = 0;
+        for (size_t b = 0; b < d_counts.size(); ++b)
+            if ((seen += d_counts.at(b)) >= rank)
+                return std::min(upper(b), d_max);
+        return d_max;
+    }
+
+  private:
+    size_t bucket(double us) const {
+        if (us < LATENCY_SUB_BUCKETS)
+            return us < 0.0 ? 0 : (size_t)us;
+        int e; // us = f * 2^e, with f in [0.5, 1) and e > 4
+        double f = frexp(us, &e);
+        size_t b = (e - 4) * LATENCY_SUB_BUCKETS +
+                   (size_t)((2.0 * f - 1.0) * LATENCY_SUB_BUCKETS);
+        return std::min(b, d_counts.size() - 1);
+    }
+
+    static double upper(size_t b) {
+        if (b < LATENCY_SUB_BUCKETS)
+            return b + 1.0;
+        int e = b / LATENCY_SUB_BUCKETS + 4;
+        double sub = b % LATENCY_SUB_BUCKETS + 1.0;
+        return ldexp(1.0 + sub / LATENCY_SUB_BUCKETS, e - 1);
+    }
+
+    std::vector<size_t> d_counts;
+    size_t d_count = 0;
+    double d_max = 0.0;
+};
+
+// The start and end events of each GEMM and compare of a --latency round
+struct LatencyEvents {
+    std::vector<CUevent> gemm, compare;
+    size_t gemms = 0, compares = 0; // Recorded
+};
+
+// A MIG instance as nvidia-smi -L lists it, which --mig burns on its own
+struct MigInstance {
+    int gpu;             // nvidia-smi's (and NVML's) index of its GPU
+    std::string gpuUuid; // Of its GPU, for NVML
+    std::string uuid;    // MIG-..., for CUDA_VISIBLE_DEVICES
+    std::string model;   // GPU name and instance profile, for the --baseline
+};
+
+class MetricsServer;
+
+// Settings shared by all burn workers, filled in from the command line
+struct BurnConfig {
+    Precision precision = FP32;
+    bool tensors = false;
+    ssize_t useBytes = 0; // 0 == use USEMEM% of free mem
+    const char *kernelFile = NULL; // NULL == the built-in fatbin
+    unsigned long long seed = DEFAULT_SEED;
+    bool pipelined = false; // Compare each slice right after its GEMM
+    bool vectorCompare = false; // 16-byte loads, one atomic per block
+    bool checksumCompare = false; // Column sums against a host reference
+    FailFast failFast = FAIL_FAST_OFF;
+    double untilStable = 0.0; // Max. coefficient of variation, in %
+    int stableWindow = DEFAULT_STABLE_WINDOW;
+    const char *baseline = NULL; // File of the throughput per GPU model
+    bool baselineUpdate = false; // Overwrite its entries with this run's
+    double slowFraction = DEFAULT_SLOW_FRACTION;
+    bool blockingSync = false;  // Sleep on events instead of polling them
+    int streams = 1;            // GEMMs are spread over this many streams
+    const char *jsonOut = NULL; // One JSON record per device per report
+    int sampleMs = DEFAULT_SAMPLE_MS;
+    bool threads = false; // One thread per GPU instead of one process
+    bool graph = false;   // Replay each round from a CUDA graph
+    MemPattern memPattern = MEM_NONE;
+    bool memOnly = false; // The memory burn without GEMMs
+    P2PPattern p2p = P2P_NONE;
+    P2PGroup *p2pGroup = NULL; // Set up by launch() for --p2p
+    bool mig = false; // A client per MIG instance instead of per GPU
+    std::vector<MigInstance> migInstances; // Of each client, from launch()
+    int mpsClients = 1; // Per GPU or MIG instance, sharing its memory
+    int mpsPercent = 0; // CUDA_MPS_ACTIVE_THREAD_PERCENTAGE, 0 == unset
+    bool affinity = true; // Run each worker on the CPUs next to its GPU
+    bool pcie = false; // Copies to the host and back next to the burn
+    bool latency = false; // Time each GEMM and compare with events
+    LoadProfile profile;
+    Engine engine = ENGINE_CUBLAS;
+    const char *sweep = NULL;    // The --sweep matrix, run point by point
+    const char *sweepOut = NULL; // CSV file of its table
+    int coordinatorPort = 0; // Collect the reports of the agents instead
+    int clusterNodes = 0;    // Agents the coordinator starts together
+    const char *agent = NULL; // HOST:PORT of the coordinator to report to
+    int agentFd = -1;         // Its socket, set up by main()
+    int daemonPort = 0; // Burn until stopped and serve /metrics on it
+    MetricsServer *metrics = NULL; // Listening on it, set up by main()
+    std::chrono::seconds stopTimeout =
+        std::chrono::seconds(SIGTERM_TIMEOUT_THRESHOLD_SECS);
+
+    // C (m*n) = A (m*k) * B (k*n)
+    size_t m = SIZE;
+    size_t n = SIZE;
+    size_t k = SIZE;
+    // Used to report op/s, one multiply and one add per inner product term,
+    // or per FMA of the engines
+    double opsPerMul() const {
+        switch (engine) {
+        case ENGINE_FMA:
+            return 2.0 * m * n * FMA_CHAINS * FMA_STEPS;
+        case ENGINE_MMA:
+            // Two m16n8k16 per 16x8 tile and step
+            return 2.0 * 16 * 8 * 16 * 2 * MMA_STEPS * (m * n / 128);
+        default:
+            return 2.0 * m * n * k;
+        }
+    }
+};
+
+// Pins the calling thread to the CPUs next to dev, and has its memory
+// allocated on their NUMA node, as sysfs has them for its PCI device.
+// Page-locked buffers allocated after this are node-local then.  Returns
+// where it went, for the startup print.
+std::string placeNearDevice(CUdevice dev) {
+    char busId[32];
+    checkError(cuDeviceGetPCIBusId(busId, sizeof(busId), dev), "Bus ID");
+    for (char *c = busId; *c; ++c)
+        *c = tolower(*c);
+    std::string sysfs = std::string("/sys/bus/pci/devices/") + busId;
+
+    std::string cpuList;
+    std::ifstream(sysfs + "/local_cpulist") >> cpuList;
+    int node = -1;
+    std::ifstream(sysfs + "/numa_node") >> node;
+
+    // "0-15,32-47"
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const char *c = cpuList.c_str(); *c;) {
+        char *end;
+        long lo = strtol(c, &end, 10), hi = lo;
+        if (end == c)
+            break;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &cpus);
+        c = *end == ',' ? end + 1 : end;
+    }
+
+    std::string placed = std::string("PCI ") + busId;
+    if (CPU_COUNT(&cpus) && !sched_setaffinity(0, sizeof(cpus), &cpus))
+        placed += ", CPUs " + cpuList;
+    else
+        placed += ", any CPU";
+    // Preferred rather than bound, so that a full node spills over
+    unsigned long nodes[16] = {0};
+    const int bits = 8 * sizeof(long);
+    bool preferred = false;
+    if (node >= 0 && node < 16 * bits) {
+        nodes[node / bits] |= 1ul << node % bits;
+        preferred = !syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes,
+                             16 * bits + 1);
+    }
+    if (preferred)
+        placed += ", NUMA node " + std::to_string(node);
+    else
+        placed += ", any NUMA node";
+    return placed;
+}
 
 template <class T> class GPU_Test {
+    typedef typename GemmTraits<T>::Result R;
+
   public:
-    GPU_Test(int dev, bool doubles, bool tensors, const char *kernelFile)
-        : d_devNumber(dev), d_doubles(doubles), d_tensors(tensors), d_kernelFile(kernelFile){
+    GPU_Test(int dev, const BurnConfig &config)
+        : d_devNumber(dev), d_precision(config.precision),
+          d_tensors(config.tensors), d_kernelFile(config.kernelFile),
+          d_pipelined(config.pipelined),
+          d_vectorCompare(config.vectorCompare),
+          d_checksumCompare(config.checksumCompare), d_graph(config.graph),
+          d_memPattern(config.memPattern), d_memOnly(config.memOnly),
+          d_p2p(config.p2pGroup), d_stopTimeout(config.stopTimeout),
+          d_sharedBy(config.mpsClients), d_pcie(config.pcie),
+          d_latency(config.latency), d_profile(config.profile),
+          d_engine(config.engine), d_opsPerMul(config.opsPerMul()),
+          d_m(config.m), d_n(config.n), d_k(config.k) {
         checkError(cuDeviceGet(&d_dev, d_devNumber));
+        // Before the context, so that the driver's threads and buffers
+        // start out on the right node too
+        if (config.affinity)
+            printf("Placed device %d at %s\n", d_devNumber,
+                   placeNearDevice(d_dev).c_str());
+        unsigned int ctxFlags =
+            config.blockingSync ? CU_CTX_SCHED_BLOCKING_SYNC : 0;
 #if defined(CUDA_VERSION) && CUDA_VERSION >= 13000
-            checkError(cuCtxCreate(&d_ctx, nullptr, 0, d_dev));
+            checkError(cuCtxCreate(&d_ctx, nullptr, ctxFlags, d_dev));
 #else
-            checkError(cuCtxCreate(&d_ctx, 0, d_dev));
+            checkError(cuCtxCreate(&d_ctx, ctxFlags, d_dev));
 #endif
 
         bind();
 
-        // checkError(cublasInit());
-        checkError(cublasCreate(&d_cublas), "init");
+        // GEMMs are spread over d_streams, each with its own cuBLAS handle
+        // (and thus workspace).  Compares run on their own stream, which in
+        // the pipelined mode checks slice i while slice i+1 is computed.
+        for (int i = 0; i < config.streams; ++i) {
+            CUstream stream;
+            cublasHandle_t handle;
+            CUevent done;
+            checkError(cuStreamCreate(&stream, CU_STREAM_DEFAULT),
+                       "compute stream");
+            // checkError(cublasInit());
+            checkError(cublasCreate(&handle), "init");
+            checkError(cublasSetStream(handle, stream), "cublas stream");
+            if (d_tensors)
+                checkError(cublasSetMathMode(handle, CUBLAS_TENSOR_OP_MATH));
+            checkError(cuEventCreate(&done, CU_EVENT_DISABLE_TIMING),
+                       "stream event");
+            d_streams.push_back(stream);
+            d_cublas.push_back(handle);
+            d_streamDone.push_back(done);
+        }
+        checkError(cuStreamCreate(&d_compareStream, CU_STREAM_DEFAULT),
+                   "compare stream");
+        checkError(cuEventCreate(&d_sliceDone, CU_EVENT_DISABLE_TIMING),
+                   "slice event");
+        checkError(cuEventCreate(&d_compareDone, CU_EVENT_DISABLE_TIMING),
+                   "compare event");
+        checkError(cuEventRecord(d_compareDone, d_compareStream),
+                   "compare event");
+        checkError(cuEventCreate(&d_graphFork, CU_EVENT_DISABLE_TIMING),
+                   "graph event");
+        if (d_profile.shape != PROFILE_FLAT) {
+            for (int i = 0; i < PROFILE_DEPTH; ++i)
+                checkError(cuEventCreate(&d_gateEvents[i],
+                                         CU_EVENT_DISABLE_TIMING),
+                           "gate event");
+            d_phaseTime.resize(d_profile.phases());
+            d_phaseGemms.resize(d_profile.phases());
+        }
+        // The memory burn gets a stream of its own next to the GEMMs
+        if (d_memPattern != MEM_NONE)
+            checkError(cuStreamCreate(&d_memStream, CU_STREAM_DEFAULT),
+                       "mem stream");
 
-        if (d_tensors)
-            checkError(cublasSetMathMode(d_cublas, CUBLAS_TENSOR_OP_MATH));
+        if (d_precision == FP8)
+            initLt();
 
-        checkError(cuMemAllocHost((void **)&d_faultyElemsHost, sizeof(int)));
+        checkError(cuMemHostAlloc((void **)&d_faultyElemsHost,
+                                  sizeof(FaultLog), 0));
+        checkError(cuMemHostAlloc((void **)&d_memFaultyHost, sizeof(int), 0));
+        d_faultyElemsHost->faultyElems = d_faultyElemsHost->logged = 0;
+        *d_memFaultyHost = 0;
         d_error = 0;
 
         g_running = true;
@@ -136,28 +722,103 @@ template <class T> class GPU_Test {
     }
     ~GPU_Test() {
         bind();
-        checkError(cuMemFree(d_Cdata), "Free A");
+        if (d_pcie)
+            destroyPcie();
+        if (d_profile.shape != PROFILE_FLAT)
+            for (int i = 0; i < PROFILE_DEPTH; ++i)
+                cuEventDestroy(d_gateEvents[i]);
+        for (size_t s = 0; s < LATENCY_SETS; ++s) {
+            LatencyEvents &set = d_latencySets[s];
+            for (size_t e = 0; e < set.gemm.size(); ++e)
+                cuEventDestroy(set.gemm.at(e));
+            for (size_t e = 0; e < set.compare.size(); ++e)
+                cuEventDestroy(set.compare.at(e));
+        }
+        if (d_p2p)
+            destroyP2P();
+        if (d_precision == FP8)
+            destroyLt();
+        freeResults();
         checkError(cuMemFree(d_Adata), "Free B");
         checkError(cuMemFree(d_Bdata), "Free C");
+        if (d_memPattern != MEM_NONE && !d_memOnly)
+            checkError(cuMemFree(d_memData), "Free mem");
+        if (d_checksumCompare) {
+            checkError(cuMemFree(d_sums), "Free sums");
+            checkError(cuMemFree(d_ref), "Free reference");
+            checkError(cuMemFree(d_refAbs), "Free reference");
+        }
+        if (d_engine != ENGINE_CUBLAS)
+            checkError(cuMemFree(d_engineAnswer), "Free answer");
         cuMemFreeHost(d_faultyElemsHost);
+        cuMemFreeHost(d_memFaultyHost);
         printf("Freed memory for dev %d\n", d_devNumber);
 
-        cublasDestroy(d_cublas);
+        if (d_graphExec)
+            cuGraphExecDestroy(d_graphExec);
+        cuEventDestroy(d_graphFork);
+        cuEventDestroy(d_sliceDone);
+        cuEventDestroy(d_compareDone);
+        cuStreamDestroy(d_compareStream);
+        if (d_memPattern != MEM_NONE)
+            cuStreamDestroy(d_memStream);
+        for (size_t i = 0; i < d_streams.size(); ++i) {
+            cublasDestroy(d_cublas.at(i));
+            cuEventDestroy(d_streamDone.at(i));
+            cuStreamDestroy(d_streams.at(i));
+        }
         printf("Uninitted cublas\n");
     }
 
-    static void termHandler(int signum) { g_running = false; }
+    static void termHandler(int signum) {
+        g_running = false;
+        g_stopRequested = 1;
+    }
 
     unsigned long long int getErrors() {
-        if (*d_faultyElemsHost) {
-            d_error += (long long int)*d_faultyElemsHost;
+        if (d_faultyElemsHost->faultyElems) {
+            d_error += (long long int)d_faultyElemsHost->faultyElems;
+        }
+        if (*d_memFaultyHost)
+            d_error += (long long int)*d_memFaultyHost;
+        if (d_pcie) {
+            std::lock_guard<std::mutex> lock(d_pcieMutex);
+            d_error += d_pcieErrors;
+            d_pcieErrors = 0;
         }
         unsigned long long int tempErrs = d_error;
         d_error = 0;
         return tempErrs;
     }
 
-    size_t getIters() { return d_iters; }
+    // Appends what the last compare logged
+    void getFaults(std::vector<FaultRecord> &faults) {
+        unsigned int logged = d_faultyElemsHost->logged;
+        if (logged > FAULT_LOG_SIZE)
+            logged = FAULT_LOG_SIZE;
+        faults.insert(faults.end(), d_faultyElemsHost->records,
+                      d_faultyElemsHost->records + logged);
+    }
+
+    size_t getIters() { return d_memOnly ? 0 : d_iters; }
+
+    // Bytes the memory burn reads and writes per round
+    size_t getMemBytes() {
+        return d_memPattern == MEM_NONE ? 0 : 4 * d_memVecs * g_memWordSize;
+    }
+
+    // The MB/s of the --pcie copies up to the device and down to the host
+    // since the last call, or as of then if none have completed since
+    void getPcieRates(unsigned int &up, unsigned int &down) {
+        std::lock_guard<std::mutex> lock(d_pcieMutex);
+        if (d_pcieUpSecs > 0.0 && d_pcieDownSecs > 0.0) {
+            d_pcieUpRate = d_pcieBytes / d_pcieUpSecs / 1e6;
+            d_pcieDownRate = d_pcieBytes / d_pcieDownSecs / 1e6;
+            d_pcieBytes = d_pcieUpSecs = d_pcieDownSecs = 0.0;
+        }
+        up = d_pcieUpRate;
+        down = d_pcieDownRate;
+    }
 
     void bind() { checkError(cuCtxSetCurrent(d_ctx), "Bind CTX"); }
 
@@ -175,216 +836,1469 @@ template <class T> class GPU_Test {
         return freeMem;
     }
 
-    void initBuffers(T *A, T *B, ssize_t useBytes = 0) {
+    void initBuffers(ssize_t useBytes = 0,
+                     unsigned long long seed = DEFAULT_SEED) {
         bind();
 
+        if (d_p2p)
+            initP2P();
+        if (d_pcie)
+            initPcie();
+
+        // Clients sharing the device start together, so they each take
+        // their part of the total rather than of what's still free
+        double memory = d_sharedBy > 1
+                            ? (double)totalMemory() / d_sharedBy
+                            : (double)availMemory();
         if (useBytes == 0)
-            useBytes = (ssize_t)((double)availMemory() * USEMEM);
+            useBytes = (ssize_t)(memory * USEMEM);
         if (useBytes < 0)
-            useBytes = (ssize_t)((double)availMemory() * (-useBytes / 100.0));
+            useBytes = (ssize_t)(memory * (-useBytes / 100.0));
 
         printf("Initialized device %d with %lu MB of memory (%lu MB available, "
-               "using %lu MB of it), %s%s\n",
+               "using %lu MB of it), %s%s%s%s%s%s, %zu stream%s\n",
                d_devNumber, totalMemory() / 1024ul / 1024ul,
                availMemory() / 1024ul / 1024ul, useBytes / 1024ul / 1024ul,
-               d_doubles ? "using DOUBLES" : "using FLOATS",
-               d_tensors ? ", using Tensor Cores" : "");
-        size_t d_resultSize = sizeof(T) * SIZE * SIZE;
-        d_iters = (useBytes - 2 * d_resultSize) /
-                  d_resultSize; // We remove A and B sizes
-        printf("Results are %zu bytes each, thus performing %zu iterations\n",
-               d_resultSize, d_iters);
-        if ((size_t)useBytes < 3 * d_resultSize)
-            throw std::string("Low mem for result. aborting.\n");
-        checkError(cuMemAlloc(&d_Cdata, d_iters * d_resultSize), "C alloc");
-        checkError(cuMemAlloc(&d_Adata, d_resultSize), "A alloc");
-        checkError(cuMemAlloc(&d_Bdata, d_resultSize), "B alloc");
-
-        checkError(cuMemAlloc(&d_faultyElemData, sizeof(int)), "faulty data");
-
-        // Populating matrices A and B
-        checkError(cuMemcpyHtoD(d_Adata, A, d_resultSize), "A -> device");
-        checkError(cuMemcpyHtoD(d_Bdata, B, d_resultSize), "B -> device");
+               g_precisionDescs[d_precision],
+               d_engine == ENGINE_FMA   ? ", FMA engine"
+               : d_engine == ENGINE_MMA ? ", MMA engine"
+                                        : "",
+               d_tensors ? ", using Tensor Cores" : "",
+               d_pipelined ? ", pipelined compare" : "",
+               d_vectorCompare ? ", vector compare" : "",
+               d_checksumCompare ? ", checksum compare" : "",
+               d_streams.size(), d_streams.size() > 1 ? "s" : "");
+        d_memSeed = seed;
+        d_resultSize = sizeof(R) * d_m * d_n;
+        size_t inputSize = sizeof(T) * (d_m * d_k + d_k * d_n);
+        // The checksum compare needs the column sums of every slice, and
+        // the reference sums
+        size_t sumsSize = d_checksumCompare ? sizeof(double) * d_n : 0;
+        inputSize += 2 * sumsSize;
+        if ((size_t)useBytes < inputSize + d_resultSize)
+            throw std::runtime_error("Low mem for result. aborting.");
+        // Next to the GEMMs the memory burn gets half of what's left
+        size_t memBytes = 0;
+        if (d_memPattern != MEM_NONE && !d_memOnly) {
+            memBytes = (useBytes - inputSize) / 2 / g_memWordSize *
+                       g_memWordSize;
+            useBytes -= memBytes;
+        }
+        d_iters = (useBytes - inputSize) /
+                  (d_resultSize + sumsSize); // We remove A and B sizes
+        // The compares need a slice at least
+        if (!d_iters)
+            throw std::runtime_error("Low mem for result. aborting.");
+        // The rest first, the results may get less than asked for
+        checkError(cuMemAlloc(&d_Adata, sizeof(T) * d_m * d_k), "A alloc");
+        checkError(cuMemAlloc(&d_Bdata, sizeof(T) * d_k * d_n), "B alloc");
+        if (d_checksumCompare) {
+            checkError(cuMemAlloc(&d_sums, d_iters * sumsSize), "sums alloc");
+            checkError(cuMemAlloc(&d_ref, sumsSize), "reference alloc");
+            checkError(cuMemAlloc(&d_refAbs, sumsSize), "reference alloc");
+        }
+        if (d_memPattern != MEM_NONE && !d_memOnly)
+            checkError(cuMemAlloc(&d_memData, memBytes), "mem alloc");
+        allocResults();
+        printf("Results are %zux%zu (k = %zu), %zu bytes each, thus performing "
+               "%zu iterations\n",
+               d_m, d_n, d_k, d_resultSize, d_iters);
+        if (d_memPattern != MEM_NONE) {
+            // Without the GEMMs it's run over what they would've used
+            if (d_memOnly) {
+                d_memData = d_Cdata;
+                memBytes = d_iters * d_resultSize;
+            }
+            d_memVecs = memBytes / g_memWordSize;
+            printf("Memory burn over %zu MB with the %s pattern\n",
+                   memBytes / 1024ul / 1024ul, g_memPatternNames[d_memPattern]);
+        }
+
+        checkError(cuMemAlloc(&d_faultyElemData, sizeof(FaultLog)),
+                   "faulty data");
+        checkError(cuMemAlloc(&d_memFaultyData, sizeof(int)), "faulty data");
 
         initCompareKernel();
+
+        // Populating matrices A and B on the device, no host copy needed
+        initMatrix(d_Adata, d_m * d_k, seed, 0);
+        initMatrix(d_Bdata, d_k * d_n, seed, 1);
+
+        if (d_checksumCompare)
+            initReference();
+        if (d_engine != ENGINE_CUBLAS)
+            initEngineAnswer();
+
+        if (d_p2p)
+            startP2P();
+        if (d_pcie)
+            d_pcieThread = std::thread(&GPU_Test::pcieLoop, this);
     }
 
-    void compute() {
-        bind();
-        static const float alpha = 1.0f;
-        static const float beta = 0.0f;
-        static const double alphaD = 1.0;
-        static const double betaD = 0.0;
+    // The results are mapped from chunks of physical memory through the
+    // virtual memory API, so that they needn't be one free block.  A chunk
+    // that can't be had is halved, down to the granularity, and the
+    // iterations are cut to what got mapped.  Without the API C is one
+    // cuMemAlloc, retried with fewer iterations while it fails.
+    void allocResults() {
+        int vmm = 0;
+        checkError(cuDeviceGetAttribute(
+            &vmm, CU_DEVICE_ATTRIBUTE_VIRTUAL_MEMORY_MANAGEMENT_SUPPORTED,
+            d_dev));
+        if (vmm && mapResults())
+            return;
 
-        for (size_t i = 0; i < d_iters; ++i) {
-            if (d_doubles)
-                checkError(
-                    cublasDgemm(d_cublas, CUBLAS_OP_N, CUBLAS_OP_N, SIZE, SIZE,
-                                SIZE, &alphaD, (const double *)d_Adata, SIZE,
-                                (const double *)d_Bdata, SIZE, &betaD,
-                                (double *)d_Cdata + i * SIZE * SIZE, SIZE),
-                    "DGEMM");
-            else
-                checkError(
-                    cublasSgemm(d_cublas, CUBLAS_OP_N, CUBLAS_OP_N, SIZE, SIZE,
-                                SIZE, &alpha, (const float *)d_Adata, SIZE,
-                                (const float *)d_Bdata, SIZE, &beta,
-                                (float *)d_Cdata + i * SIZE * SIZE, SIZE),
-                    "SGEMM");
-        }
+        CUresult res;
+        while ((res = cuMemAlloc(&d_Cdata, d_iters * d_resultSize)) ==
+                   CUDA_ERROR_OUT_OF_MEMORY &&
+               d_iters > 1)
+            d_iters -= std::max(d_iters / 16, (size_t)1);
+        checkError(res, "C alloc");
     }
 
-    void initCompareKernel() {
-        {
-            std::ifstream f(d_kernelFile);
-            checkError(f.good() ? CUDA_SUCCESS : CUDA_ERROR_NOT_FOUND,
-                       std::string("couldn't find compare kernel: ") + d_kernelFile);
+    bool mapResults() {
+        CUmemAllocationProp prop;
+        memset(&prop, 0, sizeof(prop));
+        prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+        prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+        prop.location.id = d_dev;
+        size_t granularity;
+        if (cuMemGetAllocationGranularity(&granularity, &prop,
+                                          CU_MEM_ALLOC_GRANULARITY_RECOMMENDED))
+            return false;
+        size_t bytes = d_iters * d_resultSize;
+        // Only kept once it's reserved, freeResults() goes by it
+        size_t reserved = (bytes + granularity - 1) / granularity * granularity;
+        if (cuMemAddressReserve(&d_Cdata, reserved, 0, 0, 0))
+            return false;
+        d_resultsReserved = reserved;
+
+        size_t chunk = RESULT_CHUNK_MB * 1024ul * 1024ul;
+        chunk = std::max(chunk / granularity, (size_t)1) * granularity;
+        size_t chunks = 0;
+        d_resultsMapped = 0;
+        while (d_resultsMapped < d_resultsReserved) {
+            size_t size = std::min(chunk, d_resultsReserved - d_resultsMapped);
+            CUmemGenericAllocationHandle handle;
+            if (cuMemCreate(&handle, size, &prop, 0) != CUDA_SUCCESS) {
+                if (chunk == granularity)
+                    break;
+                chunk = std::max(chunk / 2 / granularity, (size_t)1) *
+                        granularity;
+                continue;
+            }
+            // The mapping keeps the memory until it's unmapped
+            CUresult res =
+                cuMemMap(d_Cdata + d_resultsMapped, size, 0, handle, 0);
+            cuMemRelease(handle);
+            if (res != CUDA_SUCCESS)
+                break;
+            d_resultsMapped += size;
+            ++chunks;
         }
-        checkError(cuModuleLoad(&d_module, d_kernelFile), "load module");
-        checkError(cuModuleGetFunction(&d_function, d_module,
-                                       d_doubles ? "compareD" : "compare"),
-                   "get func");
 
-        checkError(cuFuncSetCacheConfig(d_function, CU_FUNC_CACHE_PREFER_L1),
-                   "L1 config");
-        checkError(cuParamSetSize(d_function, __alignof(T *) +
-                                                  __alignof(int *) +
-                                                  __alignof(size_t)),
-                   "set param size");
-        checkError(cuParamSetv(d_function, 0, &d_Cdata, sizeof(T *)),
-                   "set param");
-        checkError(cuParamSetv(d_function, __alignof(T *), &d_faultyElemData,
-                               sizeof(T *)),
-                   "set param");
-        checkError(cuParamSetv(d_function, __alignof(T *) + __alignof(int *),
-                               &d_iters, sizeof(size_t)),
-                   "set param");
-
-        checkError(cuFuncSetBlockShape(d_function, g_blockSize, g_blockSize, 1),
-                   "set block size");
+        size_t iters = std::min(d_resultsMapped / d_resultSize, d_iters);
+        CUmemAccessDesc access;
+        access.location = prop.location;
+        access.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+        if (!iters ||
+            cuMemSetAccess(d_Cdata, d_resultsMapped, &access, 1) !=
+                CUDA_SUCCESS) {
+            freeResults();
+            return false;
+        }
+        if (iters < d_iters)
+            printf("Only got %zu MB for the results on dev %d, cutting %zu "
+                   "iterations\n",
+                   d_resultsMapped / 1024ul / 1024ul, d_devNumber,
+                   d_iters - iters);
+        printf("Results mapped from %zu chunks on dev %d\n", chunks,
+               d_devNumber);
+        d_iters = iters;
+        return true;
     }
 
-    void compare() {
-        checkError(cuMemsetD32Async(d_faultyElemData, 0, 1, 0), "memset");
-        checkError(cuLaunchGridAsync(d_function, SIZE / g_blockSize,
-                                     SIZE / g_blockSize, 0),
-                   "Launch grid");
-        checkError(cuMemcpyDtoHAsync(d_faultyElemsHost, d_faultyElemData,
-                                     sizeof(int), 0),
-                   "Read faultyelemdata");
+    void freeResults() {
+        if (!d_resultsReserved) {
+            cuMemFree(d_Cdata);
+            return;
+        }
+        if (d_resultsMapped)
+            cuMemUnmap(d_Cdata, d_resultsMapped);
+        cuMemAddressFree(d_Cdata, d_resultsReserved);
+        d_resultsReserved = d_resultsMapped = 0;
     }
 
-    bool shouldRun() { return g_running; }
+    // The column sums of C = A*B are (1^T A) B, so the reference only takes
+    // O(k(m+n)) on the host rather than a GEMM.  refAbs is the same over
+    // the absolute values, which bounds the rounding of the GEMM.
+    void initReference() {
+        // Staged in page-locked memory on the node of the GPU
+        T *A, *B;
+        checkError(cuMemHostAlloc((void **)&A,
+                                  sizeof(T) * (d_m * d_k + d_k * d_n), 0),
+                   "Reference staging");
+        B = A + d_m * d_k;
+        checkError(cuMemcpyDtoH(A, d_Adata, sizeof(T) * d_m * d_k),
+                   "Read A");
+        checkError(cuMemcpyDtoH(B, d_Bdata, sizeof(T) * d_k * d_n),
+                   "Read B");
 
-  private:
-    bool d_doubles;
-    bool d_tensors;
-    int d_devNumber;
-    const char *d_kernelFile;
-    size_t d_iters;
-    size_t d_resultSize;
+        // FP8 has A stored k*m, see initLt()
+        std::vector<double> aSum(d_k), aAbs(d_k);
+        for (size_t col = 0; col < (d_precision == FP8 ? d_m : d_k); ++col)
+            for (size_t row = 0; row < (d_precision == FP8 ? d_k : d_m);
+                 ++row) {
+                double a = GemmTraits<T>::toDouble(
+                    A[col * (d_precision == FP8 ? d_k : d_m) + row]);
+                size_t kk = d_precision == FP8 ? row : col;
+                aSum[kk] += a;
+                aAbs[kk] += fabs(a);
+            }
 
-    long long int d_error;
+        std::vector<double> ref(d_n), refAbs(d_n);
+        for (size_t j = 0; j < d_n; ++j)
+            for (size_t kk = 0; kk < d_k; ++kk) {
+                double b = GemmTraits<T>::toDouble(B[j * d_k + kk]);
+                ref[j] += aSum[kk] * b;
+                refAbs[j] += aAbs[kk] * fabs(b);
+            }
+        cuMemFreeHost(A);
 
-    static const int g_blockSize = 16;
+        checkError(cuMemcpyHtoD(d_ref, ref.data(), sizeof(double) * d_n),
+                   "Write reference");
+        checkError(
+            cuMemcpyHtoD(d_refAbs, refAbs.data(), sizeof(double) * d_n),
+            "Write reference");
+    }
 
-    CUdevice d_dev;
-    CUcontext d_ctx;
-    CUmodule d_module;
-    CUfunction d_function;
+    // The known answer of the start of a slice, from the start of A and B
+    void initEngineAnswer() {
+        size_t aElems = d_m * d_k, bElems = d_k * d_n;
+        d_engineChecked = std::min((size_t)ENGINE_CHECKED, d_elems);
+        std::vector<T> A(std::min(d_engineChecked, aElems)),
+            B(std::min(d_engineChecked, bElems)), answer(d_engineChecked);
+        checkError(cuMemcpyDtoH(A.data(), d_Adata, sizeof(T) * A.size()),
+                   "Read A");
+        checkError(cuMemcpyDtoH(B.data(), d_Bdata, sizeof(T) * B.size()),
+                   "Read B");
+        for (size_t i = 0; i < d_engineChecked; ++i)
+            answer.at(i) = engineAnswer(d_engine, A.at(i % aElems),
+                                        B.at(i % bElems));
+        checkError(cuMemAlloc(&d_engineAnswer, sizeof(T) * d_engineChecked),
+                   "answer alloc");
+        checkError(cuMemcpyHtoD(d_engineAnswer, answer.data(),
+                                sizeof(T) * d_engineChecked),
+                   "Write answer");
+    }
 
-    CUdeviceptr d_Cdata;
-    CUdeviceptr d_Adata;
-    CUdeviceptr d_Bdata;
-    CUdeviceptr d_faultyElemData;
-    int *d_faultyElemsHost;
+    // How far off from the reference the GEMM may round a column sum,
+    // relative to refAbs: k times the unit roundoff of the accumulation,
+    // plus the rounding of the result and, for TF32, of the inputs
+    double refTolerance() {
+        const double fp32 = 1.0 / (1 << 24);
+        switch (d_precision) {
+        case FP64:
+            return (d_k + 1) * (fp32 / (1 << 29));
+        case FP32:
+            return (d_k + 1) * fp32;
+        case TF32:
+            return d_k * fp32 + 2.0 / (1 << 11);
+        case FP16:
+            return d_k * fp32 + 1.0 / (1 << 11);
+        default: // BF16 and FP8, with their bfloat16 results
+            return d_k * fp32 + 1.0 / (1 << 8);
+        }
+    }
 
-    cublasHandle_t d_cublas;
-};
+    void initMatrix(CUdeviceptr M, size_t elems, unsigned long long seed,
+                    unsigned int matrix) {
+        const unsigned int blockSize = 256;
+        unsigned int gridSize = ((elems + 3) / 4 + blockSize - 1) / blockSize;
+        void *params[] = {&M, &elems, &seed, &matrix};
+        checkError(cuLaunchKernel(d_initFunction, gridSize, 1, 1, blockSize,
+                                  1, 1, 0, 0, params, NULL),
+                   "init matrix");
+    }
 
-// Returns the number of devices
-int initCuda() {
-    try {
-        CUresult initResult = cuInit(0);
-        const char *initErrStr = "<unavailable>";
-        if (cuGetErrorString(initResult, &initErrStr) != CUDA_SUCCESS ||
-            initErrStr == nullptr) {
-                initErrStr = "<unavailable>";
-            }
-        fprintf(stderr, "cuInit returned %d (%s)\n", initResult,
-            initErrStr);
-        checkError(initResult);
-    } catch (std::runtime_error e) {
-        fprintf(stderr, "Couldn't init CUDA: %s\n", e.what());
-        return 0;
+    // Issues a round of compute() and compare(), or in the graph mode
+    // replays the round captured the first time around
+    void round() {
+        if (d_memPattern != MEM_NONE)
+            memPass();
+        if (d_p2p)
+            p2pPass();
+        if (d_pcieFailed)
+            throw std::runtime_error("PCIe copies: " + d_pcieFailure);
+        if (d_memOnly)
+            return;
+        if (!d_graph) {
+            if (d_latency)
+                startLatencyRound();
+            compute();
+            compare();
+            return;
+        }
+        if (!d_graphExec)
+            capture();
+        bind();
+        checkError(cuGraphLaunch(d_graphExec, d_streams.at(0)),
+                   "launch graph");
     }
-    int deviceCount = 0;
-    checkError(cuDeviceGetCount(&deviceCount));
 
-    if (!deviceCount)
-        throw std::string("No CUDA devices");
+    // Allocates the buffers the peers send to, before the GEMMs take the
+    // memory
+    void initP2P() {
+        bind();
+        d_p2pMember = d_p2p->member(d_devNumber);
+        d_p2pVecs = P2P_MB * 1024ul * 1024ul / g_memWordSize;
+        size_t bytes = d_p2pVecs * g_memWordSize;
+        checkError(cuMemAlloc(&d_p2pSrc, bytes), "p2p alloc");
+        checkError(cuMemAlloc(&d_p2pBack, bytes), "p2p alloc");
+        for (size_t from = 0; from < d_p2p->devices.size(); ++from)
+            if (d_p2p->sends(from, d_p2pMember))
+                checkError(cuMemAlloc(&d_p2p->recv.at(d_p2pMember).at(from),
+                                      bytes),
+                           "p2p alloc");
+        d_p2p->ctx.at(d_p2pMember) = d_ctx;
+        checkError(cuStreamCreate(&d_p2pStream, CU_STREAM_DEFAULT),
+                   "p2p stream");
+        checkError(cuEventCreate(&d_p2pDone, CU_EVENT_DISABLE_TIMING),
+                   "p2p event");
+    }
 
-#ifdef USEDEV
-    if (USEDEV >= deviceCount)
-        throw std::string("Not enough devices for USEDEV");
-#endif
+    // Fills the source buffer and waits for the peers to have allocated
+    // theirs.  Links to peers that failed to init are left out.
+    void startP2P() {
+        bind();
+        // The source holds the inverse of the random pattern, which
+        // memCheck checks for
+        unsigned int pass = d_p2pMember;
+        int pattern = MEM_RANDOM;
+        void *params[] = {&d_p2pSrc, &d_p2pVecs, &pattern,
+                          &pass,     &d_memSeed, &d_memFaultyData};
+        checkError(cuLaunchKernel(d_memWriteFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_p2pStream,
+                                  params, NULL),
+                   "Launch mem write");
+        checkError(cuLaunchKernel(d_memInvertFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_p2pStream,
+                                  params, NULL),
+                   "Launch mem invert");
+        checkError(cuEventRecord(d_p2pDone, d_p2pStream), "p2p event");
 
-    return deviceCount;
-}
+        d_p2p->arrive(d_p2pMember);
 
-template <class T>
-void startBurn(int index, int writeFd, T *A, T *B, bool doubles, bool tensors,
-               ssize_t useBytes, const char *kernelFile) {
-    GPU_Test<T> *our;
-    try {
-        our = new GPU_Test<T>(index, doubles, tensors, kernelFile);
-        our->initBuffers(A, B, useBytes);
-    } catch (const std::exception &e) {
-        fprintf(stderr, "Couldn't init a GPU test: %s\n", e.what());
-        exit(EMEDIUMTYPE);
+        for (size_t to = 0; to < d_p2p->devices.size(); ++to) {
+            if (!d_p2p->sends(d_p2pMember, to) || !d_p2p->ctx.at(to))
+                continue;
+            CUdevice peer;
+            int canAccess = 0;
+            checkError(cuDeviceGet(&peer, d_p2p->devices.at(to)));
+            checkError(cuDeviceCanAccessPeer(&canAccess, d_dev, peer));
+            // Without it the copies are staged through the host
+            if (canAccess) {
+                CUresult res = cuCtxEnablePeerAccess(d_p2p->ctx.at(to), 0);
+                if (res != CUDA_ERROR_PEER_ACCESS_ALREADY_ENABLED)
+                    checkError(res, "enable peer access");
+            }
+            printf("Sending %d MB to dev %d from dev %d every round (%s)\n",
+                   P2P_MB, d_p2p->devices.at(to), d_devNumber,
+                   canAccess ? "peer access" : "through the host");
+            CUevent start, end;
+            checkError(cuEventCreate(&start, 0), "link event");
+            checkError(cuEventCreate(&end, 0), "link event");
+            d_links.push_back(to);
+            d_linkStart.push_back(start);
+            d_linkEnd.push_back(end);
+        }
+        checkError(cuMemAlloc(&d_linkFaultyData,
+                              sizeof(int) * (d_links.size() + 1)),
+                   "link faulty");
+        checkError(cuMemHostAlloc((void **)&d_linkFaultyHost,
+                                  sizeof(int) * (d_links.size() + 1), 0),
+                   "link faulty");
     }
 
-    // The actual work
-    try {
-        int eventIndex = 0;
-        const int maxEvents = 2;
-        CUevent events[maxEvents];
-        for (int i = 0; i < maxEvents; ++i)
-            cuEventCreate(events + i, 0);
+    // Sends the source to each peer and reads it back, then checks what
+    // came back.  The previous pass is accounted for first, on the host.
+    void p2pPass() {
+        bind();
+        checkError(cuEventSynchronize(d_p2pDone), "p2p sync");
+        if (d_p2pPasses++)
+            for (size_t l = 0; l < d_links.size(); ++l) {
+                float ms = 0.0f;
+                checkError(cuEventElapsedTime(&ms, d_linkStart.at(l),
+                                              d_linkEnd.at(l)),
+                           "link time");
+                d_p2p->addLink(d_p2pMember, d_links.at(l),
+                               2.0 * d_p2pVecs * g_memWordSize, ms / 1000.0,
+                               d_linkFaultyHost[l]);
+            }
 
-        int nonWorkIters = maxEvents;
+        size_t bytes = d_p2pVecs * g_memWordSize;
+        CUcontext ourCtx = d_ctx;
+        checkError(cuMemsetD32Async(d_linkFaultyData, 0, d_links.size() + 1,
+                                    d_p2pStream),
+                   "memset");
+        for (size_t l = 0; l < d_links.size(); ++l) {
+            size_t to = d_links.at(l);
+            CUdeviceptr remote = d_p2p->recv.at(to).at(d_p2pMember);
+            CUcontext peerCtx = d_p2p->ctx.at(to);
+            checkError(cuEventRecord(d_linkStart.at(l), d_p2pStream),
+                       "link event");
+            checkError(cuMemcpyPeerAsync(remote, peerCtx, d_p2pSrc, ourCtx,
+                                         bytes, d_p2pStream),
+                       "p2p send");
+            checkError(cuMemcpyPeerAsync(d_p2pBack, ourCtx, remote, peerCtx,
+                                         bytes, d_p2pStream),
+                       "p2p read back");
+            checkError(cuEventRecord(d_linkEnd.at(l), d_p2pStream),
+                       "link event");
 
-        while (our->shouldRun()) {
-            our->compute();
-            our->compare();
-            checkError(cuEventRecord(events[eventIndex], 0), "Record event");
+            unsigned int pass = d_p2pMember;
+            int pattern = MEM_RANDOM;
+            CUdeviceptr faulty = d_linkFaultyData + l * sizeof(int);
+            void *params[] = {&d_p2pBack, &d_p2pVecs, &pattern,
+                              &pass,      &d_memSeed, &faulty};
+            checkError(cuLaunchKernel(d_memCheckFunction, d_memGridSize, 1, 1,
+                                      g_sliceBlockSize, 1, 1, 0, d_p2pStream,
+                                      params, NULL),
+                       "Launch link check");
+        }
+        checkError(cuMemcpyDtoHAsync(d_linkFaultyHost, d_linkFaultyData,
+                                     sizeof(int) * d_links.size(),
+                                     d_p2pStream),
+                   "Read link faulty");
+        checkError(cuEventRecord(d_p2pDone, d_p2pStream), "p2p event");
+    }
 
-            eventIndex = ++eventIndex % maxEvents;
+    // The peers may still be sending to us, so our buffers are only freed
+    // once all of them are done
+    void destroyP2P() {
+        checkError(cuStreamSynchronize(d_p2pStream), "p2p sync");
+        d_p2p->leave(d_p2pMember, d_stopTimeout);
+        for (size_t from = 0; from < d_p2p->devices.size(); ++from)
+            if (d_p2p->recv.at(d_p2pMember).at(from))
+                cuMemFree(d_p2p->recv.at(d_p2pMember).at(from));
+        cuMemFree(d_p2pSrc);
+        cuMemFree(d_p2pBack);
+        cuMemFree(d_linkFaultyData);
+        cuMemFreeHost(d_linkFaultyHost);
+        for (size_t l = 0; l < d_links.size(); ++l) {
+            cuEventDestroy(d_linkStart.at(l));
+            cuEventDestroy(d_linkEnd.at(l));
+        }
+        cuEventDestroy(d_p2pDone);
+        cuStreamDestroy(d_p2pStream);
+    }
 
-            while (cuEventQuery(events[eventIndex]) != CUDA_SUCCESS)
-                usleep(1000);
+    // --pcie copies random data down to the host and back up in the
+    // background, on streams that aren't ordered by the rounds.  Each of
+    // the two sets of buffers is copied down while the other is copied up,
+    // which keeps both directions of the link busy.
+    void initPcie() {
+        bind();
+        d_pcieVecs = PCIE_MB * 1024ul * 1024ul / g_memWordSize;
+        size_t bytes = d_pcieVecs * g_memWordSize;
+        for (int b = 0; b < 2; ++b) {
+            checkError(cuMemAlloc(&d_pcieDown[b], bytes), "pcie alloc");
+            checkError(cuMemAlloc(&d_pcieUp[b], bytes), "pcie alloc");
+            // Page-locked, or the copies would be staged by the driver
+            checkError(cuMemHostAlloc((void **)&d_pcieHost[b], bytes, 0),
+                       "pcie host alloc");
+            // The legacy stream the rounds are timed on would sync
+            // blocking streams with the GEMMs
+            checkError(
+                cuStreamCreate(&d_pcieStream[b], CU_STREAM_NON_BLOCKING),
+                "pcie stream");
+            for (int m = 0; m < 3; ++m)
+                checkError(cuEventCreate(&d_pcieMarks[b][m], 0),
+                           "pcie event");
+            checkError(cuEventCreate(&d_pcieDone[b], CU_EVENT_DISABLE_TIMING),
+                       "pcie event");
+        }
+        checkError(cuMemAlloc(&d_pcieFaultyData, sizeof(int) * 2),
+                   "pcie faulty");
+        checkError(
+            cuMemHostAlloc((void **)&d_pcieFaultyHost, sizeof(int) * 2, 0),
+            "pcie faulty");
+        printf("Copying %d MB to the host and back continuously on dev %d\n",
+               PCIE_MB, d_devNumber);
+    }
 
-            if (--nonWorkIters > 0)
-                continue;
+    // Writes a pass of the random pattern to set b, copies it down and up,
+    // and checks what came up
+    void pcieIssue(int b, unsigned int pass) {
+        size_t bytes = d_pcieVecs * g_memWordSize;
+        CUstream stream = d_pcieStream[b];
+        int pattern = MEM_RANDOM;
+        CUdeviceptr faulty = d_pcieFaultyData + b * sizeof(int);
+        void *params[] = {&d_pcieDown[b], &d_pcieVecs, &pattern,
+                          &pass,          &d_memSeed,  &faulty};
+        checkError(cuMemsetD32Async(faulty, 0, 1, stream), "memset");
+        checkError(cuLaunchKernel(d_memWriteFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, stream, params,
+                                  NULL),
+                   "Launch pcie write");
+        checkError(cuLaunchKernel(d_memInvertFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, stream, params,
+                                  NULL),
+                   "Launch pcie invert");
+        checkError(cuEventRecord(d_pcieMarks[b][0], stream), "pcie event");
+        checkError(
+            cuMemcpyDtoHAsync(d_pcieHost[b], d_pcieDown[b], bytes, stream),
+            "pcie down");
+        checkError(cuEventRecord(d_pcieMarks[b][1], stream), "pcie event");
+        checkError(
+            cuMemcpyHtoDAsync(d_pcieUp[b], d_pcieHost[b], bytes, stream),
+            "pcie up");
+        checkError(cuEventRecord(d_pcieMarks[b][2], stream), "pcie event");
+        params[0] = &d_pcieUp[b];
+        checkError(cuLaunchKernel(d_memCheckFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, stream, params,
+                                  NULL),
+                   "Launch pcie check");
+        checkError(cuMemcpyDtoHAsync(d_pcieFaultyHost + b, faulty,
+                                     sizeof(int), stream),
+                   "Read pcie faulty");
+        checkError(cuEventRecord(d_pcieDone[b], stream), "pcie event");
+    }
 
-            int ops = our->getIters();
-            write(writeFd, &ops, sizeof(int));
-            ops = our->getErrors();
-            write(writeFd, &ops, sizeof(int));
+    // Runs in a thread of its own, which has the affinity of the worker.
+    // A failure is passed on to the worker by round().
+    void pcieLoop() {
+        try {
+            bind();
+            for (unsigned int pass = 0; !d_pcieStop; ++pass) {
+                int b = pass & 1;
+                if (pass >= 2) {
+                    checkError(cuEventSynchronize(d_pcieDone[b]),
+                               "pcie sync");
+                    float downMs, upMs;
+                    checkError(cuEventElapsedTime(&downMs,
+                                                  d_pcieMarks[b][0],
+                                                  d_pcieMarks[b][1]),
+                               "pcie time");
+                    checkError(cuEventElapsedTime(&upMs, d_pcieMarks[b][1],
+                                                  d_pcieMarks[b][2]),
+                               "pcie time");
+                    std::lock_guard<std::mutex> lock(d_pcieMutex);
+                    d_pcieBytes += d_pcieVecs * g_memWordSize;
+                    d_pcieDownSecs += downMs / 1000.0;
+                    d_pcieUpSecs += upMs / 1000.0;
+                    d_pcieErrors += d_pcieFaultyHost[b];
+                }
+                pcieIssue(b, pass);
+            }
+            for (int b = 0; b < 2; ++b)
+                checkError(cuEventSynchronize(d_pcieDone[b]), "pcie sync");
+        } catch (const std::exception &e) {
+            d_pcieFailure = e.what();
+            d_pcieFailed = true;
         }
-
-        for (int i = 0; i < maxEvents; ++i)
-            cuEventSynchronize(events[i]);
-        delete our;
-    } catch (const std::exception &e) {
-        fprintf(stderr, "Failure during compute: %s\n", e.what());
-        int ops = -1;
-        // Signalling that we failed
-        write(writeFd, &ops, sizeof(int));
-        write(writeFd, &ops, sizeof(int));
-        exit(ECONNREFUSED);
     }
-}
+
+    void destroyPcie() {
+        d_pcieStop = true;
+        if (d_pcieThread.joinable())
+            d_pcieThread.join();
+        for (int b = 0; b < 2; ++b) {
+            cuMemFree(d_pcieDown[b]);
+            cuMemFree(d_pcieUp[b]);
+            cuMemFreeHost(d_pcieHost[b]);
+            for (int m = 0; m < 3; ++m)
+                cuEventDestroy(d_pcieMarks[b][m]);
+            cuEventDestroy(d_pcieDone[b]);
+            cuStreamDestroy(d_pcieStream[b]);
+        }
+        cuMemFree(d_pcieFaultyData);
+        cuMemFreeHost(d_pcieFaultyHost);
+    }
+
+    // One pass of the memory burn on d_memStream, each with its own pattern
+    void memPass() {
+        bind();
+        int pattern = d_memPattern;
+        void *params[] = {&d_memData, &d_memVecs,      &pattern,
+                          &d_memPasses, &d_memSeed, &d_memFaultyData};
+        checkError(cuMemsetD32Async(d_memFaultyData, 0, 1, d_memStream),
+                   "memset");
+        checkError(cuLaunchKernel(d_memWriteFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_memStream,
+                                  params, NULL),
+                   "Launch mem write");
+        checkError(cuLaunchKernel(d_memInvertFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_memStream,
+                                  params, NULL),
+                   "Launch mem invert");
+        checkError(cuLaunchKernel(d_memCheckFunction, d_memGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_memStream,
+                                  params, NULL),
+                   "Launch mem check");
+        checkError(cuMemcpyDtoHAsync(d_memFaultyHost, d_memFaultyData,
+                                     sizeof(int), d_memStream),
+                   "Read mem faulty");
+        ++d_memPasses;
+    }
+
+    void capture() {
+        bind();
+        CUstream origin = d_streams.at(0);
+        checkError(
+            cuStreamBeginCapture(origin, CU_STREAM_CAPTURE_MODE_THREAD_LOCAL),
+            "begin capture");
+        // The other streams join the capture by waiting on origin
+        checkError(cuEventRecord(d_graphFork, origin), "graph event");
+        for (size_t i = 1; i < d_streams.size(); ++i)
+            checkError(cuStreamWaitEvent(d_streams.at(i), d_graphFork, 0),
+                       "wait graph");
+        checkError(cuStreamWaitEvent(d_compareStream, d_graphFork, 0),
+                   "wait graph");
+
+        d_capturing = true;
+        compute();
+        compare();
+        d_capturing = false;
+
+        // ...and all of them have to be joined back before the capture ends
+        for (size_t i = 1; i < d_streams.size(); ++i) {
+            checkError(cuEventRecord(d_streamDone.at(i), d_streams.at(i)),
+                       "stream event");
+            checkError(cuStreamWaitEvent(origin, d_streamDone.at(i), 0),
+                       "wait stream");
+        }
+        checkError(cuStreamWaitEvent(origin, d_compareDone, 0),
+                   "wait compare");
+
+        CUgraph graph;
+        checkError(cuStreamEndCapture(origin, &graph), "end capture");
+        checkError(cuGraphInstantiateWithFlags(&d_graphExec, graph, 0),
+                   "instantiate graph");
+        checkError(cuGraphDestroy(graph), "destroy graph");
+    }
+
+    void compute() {
+        bind();
+        // The previous round's compares read the slices we're about to
+        // overwrite.  Replays of a graph are ordered by their stream anyway.
+        if (!d_capturing)
+            for (size_t i = 0; i < d_streams.size(); ++i)
+                checkError(
+                    cuStreamWaitEvent(d_streams.at(i), d_compareDone, 0),
+                    "wait compare");
+        if (d_pipelined)
+            checkError(
+                cuMemsetD32Async(d_faultyElemData, 0, 2, d_compareStream),
+                "memset");
+
+        for (size_t i = 0; i < d_iters; ++i) {
+            CUstream stream = d_streams.at(i % d_streams.size());
+            if (d_profile.shape != PROFILE_FLAT)
+                gate();
+            if (d_latency)
+                markLatency(d_latencySet->gemm, d_latencySet->gemms, false,
+                            stream);
+            if (d_engine == ENGINE_CUBLAS)
+                gemm(i % d_streams.size(), d_Cdata + i * d_resultSize);
+            else
+                launchEngine(stream, d_Cdata + i * d_resultSize);
+            if (d_latency)
+                markLatency(d_latencySet->gemm, d_latencySet->gemms, true,
+                            stream);
+            if (d_profile.shape != PROFILE_FLAT)
+                checkError(cuEventRecord(
+                               d_gateEvents[d_gated++ % PROFILE_DEPTH], stream),
+                           "gate event");
+
+            if (d_pipelined)
+                compareSlice(i);
+        }
+
+        // The full compare has to wait for the last GEMM on every stream
+        if (!d_pipelined)
+            for (size_t i = 0; i < d_streams.size(); ++i) {
+                checkError(cuEventRecord(d_streamDone.at(i), d_streams.at(i)),
+                           "stream event");
+                checkError(cuStreamWaitEvent(d_compareStream,
+                                             d_streamDone.at(i), 0),
+                           "wait stream");
+            }
+    }
+
+    void gemm(size_t stream, CUdeviceptr C) {
+        static const float alpha = 1.0f;
+        static const float beta = 0.0f;
+        static const double alphaD = 1.0;
+        static const double betaD = 0.0;
+        cublasHandle_t handle = d_cublas.at(stream);
+
+        switch (d_precision) {
+        case FP64:
+            checkError(cublasDgemm(handle, CUBLAS_OP_N, CUBLAS_OP_N, d_m, d_n,
+                                   d_k, &alphaD, (const double *)d_Adata, d_m,
+                                   (const double *)d_Bdata, d_k, &betaD,
+                                   (double *)C, d_m),
+                       "DGEMM");
+            break;
+        case FP32:
+            checkError(cublasSgemm(handle, CUBLAS_OP_N, CUBLAS_OP_N, d_m, d_n,
+                                   d_k, &alpha, (const float *)d_Adata, d_m,
+                                   (const float *)d_Bdata, d_k, &beta,
+                                   (float *)C, d_m),
+                       "SGEMM");
+            break;
+        case FP8:
+            // FP8 is only available through cublasLt, with A transposed
+            checkError(cublasLtMatmul(d_lt, d_ltDesc, &alpha,
+                                      (const void *)d_Adata, d_ltA,
+                                      (const void *)d_Bdata, d_ltB, &beta,
+                                      (void *)C, d_ltC, (void *)C, d_ltC,
+                                      &d_ltAlgo,
+                                      (void *)d_ltWorkspace.at(stream),
+                                      g_ltWorkspaceSize, d_streams.at(stream)),
+                       "FP8 matmul");
+            break;
+        default:
+            // FP16 and BF16 accumulate in FP32, TF32 is FP32 with the
+            // inputs rounded to TF32 on the tensor cores
+            checkError(cublasGemmEx(handle, CUBLAS_OP_N, CUBLAS_OP_N, d_m, d_n,
+                                    d_k, &alpha, (const void *)d_Adata,
+                                    GemmTraits<T>::type(), d_m,
+                                    (const void *)d_Bdata,
+                                    GemmTraits<T>::type(), d_k, &beta,
+                                    (void *)C, GemmTraits<T>::resultType(),
+                                    d_m,
+                                    d_precision == TF32
+                                        ? CUBLAS_COMPUTE_32F_FAST_TF32
+                                        : CUBLAS_COMPUTE_32F,
+                                    CUBLAS_GEMM_DEFAULT),
+                       "GEMM");
+        }
+    }
+
+    void launchEngine(CUstream stream, CUdeviceptr C) {
+        size_t aElems = d_m * d_k, bElems = d_k * d_n;
+        void *params[] = {&d_Adata, &d_Bdata, &C,
+                          &d_elems, &aElems,  &bElems};
+        checkError(cuLaunchKernel(d_engineFunction, d_engineGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, stream, params,
+                                  NULL),
+                   "Launch engine");
+    }
+
+    void launchEngineCheck() {
+        void *params[] = {&d_Cdata, &d_engineAnswer, &d_engineChecked,
+                          &d_faultyElemData};
+        checkError(cuLaunchKernel(d_engineCheckFunction, 1, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_compareStream,
+                                  params, NULL),
+                   "Launch engine check");
+    }
+
+    void initLt() {
+        if (d_m % 16 || d_n % 16 || d_k % 16)
+            throw std::runtime_error("FP8 needs M, N and K to be multiples of "
+                                     "16");
+
+        checkError(cublasLtCreate(&d_lt), "init lt");
+        checkError(cublasLtMatmulDescCreate(&d_ltDesc, CUBLAS_COMPUTE_32F,
+                                            CUDA_R_32F),
+                   "matmul desc");
+        cublasOperation_t transA = CUBLAS_OP_T, transB = CUBLAS_OP_N;
+        checkError(cublasLtMatmulDescSetAttribute(d_ltDesc,
+                                                  CUBLASLT_MATMUL_DESC_TRANSA,
+                                                  &transA, sizeof(transA)),
+                   "matmul desc");
+        checkError(cublasLtMatmulDescSetAttribute(d_ltDesc,
+                                                  CUBLASLT_MATMUL_DESC_TRANSB,
+                                                  &transB, sizeof(transB)),
+                   "matmul desc");
+        // A is stored k*m so that its transpose is the m*k we multiply
+        checkError(cublasLtMatrixLayoutCreate(&d_ltA, GemmTraits<T>::type(),
+                                              d_k, d_m, d_k),
+                   "layout A");
+        checkError(cublasLtMatrixLayoutCreate(&d_ltB, GemmTraits<T>::type(),
+                                              d_k, d_n, d_k),
+                   "layout B");
+        checkError(cublasLtMatrixLayoutCreate(
+                       &d_ltC, GemmTraits<T>::resultType(), d_m, d_n, d_m),
+                   "layout C");
+
+        cublasLtMatmulPreference_t pref;
+        size_t workspaceSize = g_ltWorkspaceSize;
+        checkError(cublasLtMatmulPreferenceCreate(&pref), "matmul pref");
+        checkError(cublasLtMatmulPreferenceSetAttribute(
+                       pref, CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES,
+                       &workspaceSize, sizeof(workspaceSize)),
+                   "matmul pref");
+        cublasLtMatmulHeuristicResult_t heuristic;
+        int found = 0;
+        checkError(cublasLtMatmulAlgoGetHeuristic(d_lt, d_ltDesc, d_ltA, d_ltB,
+                                                  d_ltC, d_ltC, pref, 1,
+                                                  &heuristic, &found),
+                   "FP8 heuristic");
+        cublasLtMatmulPreferenceDestroy(pref);
+        if (!found)
+            throw std::runtime_error("No FP8 matmul available on this device");
+        d_ltAlgo = heuristic.algo;
+
+        // One workspace per stream, as with the cuBLAS handles
+        for (size_t i = 0; i < d_streams.size(); ++i) {
+            CUdeviceptr workspace;
+            checkError(cuMemAlloc(&workspace, g_ltWorkspaceSize),
+                       "lt workspace");
+            d_ltWorkspace.push_back(workspace);
+        }
+    }
+
+    void destroyLt() {
+        for (size_t i = 0; i < d_ltWorkspace.size(); ++i)
+            cuMemFree(d_ltWorkspace.at(i));
+        cublasLtMatrixLayoutDestroy(d_ltA);
+        cublasLtMatrixLayoutDestroy(d_ltB);
+        cublasLtMatrixLayoutDestroy(d_ltC);
+        cublasLtMatmulDescDestroy(d_ltDesc);
+        cublasLtDestroy(d_lt);
+    }
+
+    // Queues the comparison of slice i against slice 0 on the compare stream,
+    // to start as soon as the GEMM producing slice i is done.  The compare
+    // stream is in order, so waiting for slice 0 once covers all the others.
+    void compareSlice(size_t i) {
+        checkError(cuEventRecord(d_sliceDone,
+                                 d_streams.at(i % d_streams.size())),
+                   "slice event");
+        checkError(cuStreamWaitEvent(d_compareStream, d_sliceDone, 0),
+                   "wait slice");
+        if (i == 0 && !d_checksumCompare)
+            return;
+
+        if (d_latency)
+            markLatency(d_latencySet->compare, d_latencySet->compares, false,
+                        d_compareStream);
+        if (d_checksumCompare)
+            launchColumnSums(i, 1);
+        else {
+            CUdeviceptr slice = d_Cdata + i * d_resultSize;
+            size_t elems = d_m * d_n;
+            size_t slices = 1;
+            void *params[] = {&d_Cdata, &slice, &d_faultyElemData, &elems,
+                              &slices,  &i};
+            checkError(cuLaunchKernel(d_sliceFunction, d_sliceGridSize, 1,
+                                      1, g_sliceBlockSize, 1, 1, 0,
+                                      d_compareStream, params, NULL),
+                       "Launch slice compare");
+        }
+        if (d_latency)
+            markLatency(d_latencySet->compare, d_latencySet->compares, true,
+                        d_compareStream);
+    }
+
+    // Takes the events for this round, first adding what they timed
+    // LATENCY_SETS rounds ago to the histograms
+    void startLatencyRound() {
+        d_latencySet = &d_latencySets[d_latencyRounds++ % LATENCY_SETS];
+        readLatency(*d_latencySet);
+    }
+
+    void readLatency(LatencyEvents &set) {
+        for (size_t i = 0; i < set.gemms; ++i)
+            d_gemmLatency.add(
+                elapsedUs(set.gemm.at(2 * i), set.gemm.at(2 * i + 1)));
+        for (size_t i = 0; i < set.compares; ++i)
+            d_compareLatency.add(
+                elapsedUs(set.compare.at(2 * i), set.compare.at(2 * i + 1)));
+        set.gemms = set.compares = 0;
+    }
+
+    double elapsedUs(CUevent start, CUevent end) {
+        float ms;
+        checkError(cuEventSynchronize(end), "latency sync");
+        checkError(cuEventElapsedTime(&ms, start, end), "latency time");
+        return ms * 1000.0;
+    }
+
+    // Records the start or the end of the next GEMM or compare of a round,
+    // creating the events the first time around
+    void markLatency(std::vector<CUevent> &events, size_t &recorded, bool end,
+                     CUstream stream) {
+        size_t e = 2 * recorded + end;
+        while (events.size() <= e) {
+            CUevent event;
+            checkError(cuEventCreate(&event, 0), "latency event");
+            events.push_back(event);
+        }
+        checkError(cuEventRecord(events.at(e), stream), "latency event");
+        if (end)
+            ++recorded;
+    }
+
+    // --profile: holds the next GEMM back while the load is off, with at
+    // most PROFILE_DEPTH of them queued so that the GPU idles soon after it
+    // turns off.  GEMMs and the time in between go to the phase they're
+    // issued in.
+    void gate() {
+        if (d_gated >= PROFILE_DEPTH) {
+            CUevent queued = d_gateEvents[d_gated % PROFILE_DEPTH];
+            CUresult res;
+            while ((res = cuEventQuery(queued)) == CUDA_ERROR_NOT_READY) {
+                accountPhase();
+                usleep(500);
+            }
+            checkError(res, "gate event");
+        }
+        while (!d_profile.on(monotonicTime())) {
+            accountPhase();
+            usleep(1000);
+        }
+        accountPhase();
+        ++d_phaseGemms.at(d_profile.phase(d_gateLast));
+    }
+
+    void accountPhase() {
+        double now = monotonicTime();
+        if (d_gateLast)
+            d_phaseTime.at(d_profile.phase(now)) += now - d_gateLast;
+        d_gateLast = now;
+    }
+
+    // Prints the Gflop/s of each phase of the --profile
+    void reportProfile() {
+        if (d_profile.shape == PROFILE_FLAT)
+            return;
+        printf("Gflop/s per phase on dev %d:", d_devNumber);
+        for (int p = 0; p < d_profile.phases(); ++p)
+            printf(" %s %.0f (%.1f s)", d_profile.phaseName(p).c_str(),
+                   d_phaseTime.at(p) > 0.0
+                       ? d_opsPerMul * d_phaseGemms.at(p) /
+                             d_phaseTime.at(p) / 1e9
+                       : 0.0,
+                   d_phaseTime.at(p));
+        printf("\n");
+    }
+
+    // Prints the GEMM and compare latencies, once the rounds are done
+    void reportLatency() {
+        if (!d_latency)
+            return;
+        for (size_t s = 0; s < LATENCY_SETS; ++s)
+            readLatency(d_latencySets[s]);
+        const LatencyHistogram *histograms[] = {&d_gemmLatency,
+                                                &d_compareLatency};
+        const char *names[] = {"GEMM", "Compare"};
+        for (int h = 0; h < 2; ++h) {
+            const LatencyHistogram &l = *histograms[h];
+            if (!l.count())
+                continue;
+            printf("%s latency on dev %d: p50 %.3f ms, p99 %.3f ms, max "
+                   "%.3f ms, p99/p50 %.2f (%zu timed)\n",
+                   names[h], d_devNumber, l.percentile(50.0) / 1000.0,
+                   l.percentile(99.0) / 1000.0, l.max() / 1000.0,
+                   l.percentile(99.0) / l.percentile(50.0), l.count());
+        }
+    }
+
+    // Enough blocks of blockSize threads to fill every SM of the device
+    unsigned int fullGridSize(CUfunction function, int blockSize) {
+        int smCount, blocksPerSm;
+        checkError(cuDeviceGetAttribute(
+                       &smCount, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
+                       d_dev),
+                   "SM count");
+        checkError(cuOccupancyMaxActiveBlocksPerMultiprocessor(
+                       &blocksPerSm, function, blockSize, 0),
+                   "occupancy");
+        return smCount * blocksPerSm;
+    }
+
+    void initCompareKernel() {
+        if (d_kernelFile) {
+            std::ifstream f(d_kernelFile);
+            checkError(f.good() ? CUDA_SUCCESS : CUDA_ERROR_NOT_FOUND,
+                       std::string("couldn't find compare kernel: ") + d_kernelFile);
+            checkError(cuModuleLoad(&d_module, d_kernelFile), "load module");
+        } else
+            checkError(cuModuleLoadData(&d_module, _binary_compare_fatbin_start),
+                       "load module");
+        std::string suffix = GemmTraits<T>::compareSuffix();
+        checkError(cuModuleGetFunction(&d_function, d_module,
+                                       ("compare" + suffix).c_str()),
+                   "get func");
+        checkError(cuModuleGetFunction(
+                       &d_initFunction, d_module,
+                       (std::string("initMatrix") + GemmTraits<T>::initSuffix())
+                           .c_str()),
+                   "get init func");
+
+        // Both handle any number of slices, the pipelined mode does one
+        if ((d_pipelined || d_vectorCompare) && !d_checksumCompare) {
+            std::string name =
+                (d_vectorCompare ? "compareVec" : "compareSlice") + suffix;
+            checkError(
+                cuModuleGetFunction(&d_sliceFunction, d_module, name.c_str()),
+                "get slice func");
+            d_sliceGridSize = fullGridSize(d_sliceFunction, g_sliceBlockSize);
+        }
+
+        if (d_checksumCompare) {
+            checkError(cuModuleGetFunction(&d_sumsFunction, d_module,
+                                           ("columnSums" + suffix).c_str()),
+                       "get sums func");
+            checkError(cuModuleGetFunction(&d_checkSumsFunction, d_module,
+                                           "checkColumnSums"),
+                       "get sums func");
+            d_sumsGridSize = fullGridSize(d_sumsFunction, g_sliceBlockSize);
+            d_checkSumsGridSize =
+                fullGridSize(d_checkSumsFunction, g_sliceBlockSize);
+        }
+
+        checkError(cuFuncSetCacheConfig(d_function, CU_FUNC_CACHE_PREFER_L1),
+                   "L1 config");
+        d_elems = d_m * d_n;
+
+        if (d_engine != ENGINE_CUBLAS) {
+            int major;
+            checkError(cuDeviceGetAttribute(
+                &major, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, d_dev));
+            if (d_engine == ENGINE_MMA && major < 8)
+                throw std::runtime_error("--engine mma needs compute "
+                                         "capability 8.0 or later");
+            if (d_engine == ENGINE_MMA && d_elems % (128 * MMA_TILES))
+                throw std::runtime_error("--engine mma needs M*N to be a "
+                                         "multiple of 512");
+            std::string name = d_engine == ENGINE_MMA ? "mmaBurn" : "fmaBurn";
+            checkError(cuModuleGetFunction(&d_engineFunction, d_module,
+                                           d_engine == ENGINE_MMA
+                                               ? name.c_str()
+                                               : (name + suffix).c_str()),
+                       "get engine func");
+            checkError(cuModuleGetFunction(&d_engineCheckFunction, d_module,
+                                           ("engineCheck" + suffix).c_str()),
+                       "get engine func");
+            d_engineGridSize =
+                fullGridSize(d_engineFunction, g_sliceBlockSize);
+        }
+
+        if (d_memPattern != MEM_NONE || d_p2p || d_pcie) {
+            checkError(cuModuleGetFunction(&d_memWriteFunction, d_module,
+                                           "memWrite"),
+                       "get mem func");
+            checkError(cuModuleGetFunction(&d_memInvertFunction, d_module,
+                                           "memInvert"),
+                       "get mem func");
+            checkError(cuModuleGetFunction(&d_memCheckFunction, d_module,
+                                           "memCheck"),
+                       "get mem func");
+            d_memGridSize =
+                fullGridSize(d_memInvertFunction, g_sliceBlockSize);
+        }
+    }
+
+    void compare() {
+        // In the pipelined mode the slices have been compared as they were
+        // produced, only the result is left to fetch
+        if (!d_pipelined) {
+            // Clears the count and the log
+            checkError(
+                cuMemsetD32Async(d_faultyElemData, 0, 2, d_compareStream),
+                "memset");
+            if (d_latency)
+                markLatency(d_latencySet->compare, d_latencySet->compares,
+                            false, d_compareStream);
+            if (d_checksumCompare)
+                launchColumnSums(0, d_iters);
+            else
+                launchCompare();
+        }
+        if (d_engine != ENGINE_CUBLAS)
+            launchEngineCheck();
+        if (d_checksumCompare)
+            launchCheckSums();
+        if (d_latency && !d_pipelined)
+            markLatency(d_latencySet->compare, d_latencySet->compares, true,
+                        d_compareStream);
+        checkError(cuMemcpyDtoHAsync(d_faultyElemsHost, d_faultyElemData,
+                                     sizeof(FaultLog), d_compareStream),
+                   "Read faultyelemdata");
+        checkError(cuEventRecord(d_compareDone, d_compareStream),
+                   "compare event");
+    }
+
+    void launchCompare() {
+        if (d_vectorCompare) {
+            CUdeviceptr first = d_Cdata + d_resultSize;
+            size_t elems = d_m * d_n;
+            size_t slices = d_iters - 1;
+            size_t firstSlice = 1;
+            void *params[] = {&d_Cdata, &first,  &d_faultyElemData,
+                              &elems,   &slices, &firstSlice};
+            checkError(cuLaunchKernel(d_sliceFunction, d_sliceGridSize, 1, 1,
+                                      g_sliceBlockSize, 1, 1, 0,
+                                      d_compareStream, params, NULL),
+                       "Launch vector compare");
+        } else {
+            void *params[] = {&d_Cdata, &d_faultyElemData, &d_iters, &d_elems};
+            checkError(cuLaunchKernel(d_function,
+                                      (d_n + g_blockSize - 1) / g_blockSize,
+                                      (d_m + g_blockSize - 1) / g_blockSize, 1,
+                                      g_blockSize, g_blockSize, 1, 0,
+                                      d_compareStream, params, NULL),
+                       "Launch grid");
+        }
+    }
+
+    void launchColumnSums(size_t first, size_t slices) {
+        CUdeviceptr C = d_Cdata + first * d_resultSize;
+        void *params[] = {&C, &d_sums, &d_m, &d_n, &slices, &first};
+        checkError(cuLaunchKernel(d_sumsFunction, d_sumsGridSize, 1, 1,
+                                  g_sliceBlockSize, 1, 1, 0, d_compareStream,
+                                  params, NULL),
+                   "Launch column sums");
+    }
+
+    void launchCheckSums() {
+        double refTol = refTolerance();
+        double sliceTol = GemmTraits<T>::epsilon();
+        void *params[] = {&d_sums, &d_ref,  &d_refAbs, &d_faultyElemData,
+                          &d_m,    &d_n,    &d_iters,  &refTol,
+                          &sliceTol};
+        checkError(cuLaunchKernel(d_checkSumsFunction, d_checkSumsGridSize, 1,
+                                  1, g_sliceBlockSize, 1, 1, 0,
+                                  d_compareStream, params, NULL),
+                   "Launch sums check");
+    }
+
+    bool shouldRun() { return g_running; }
+
+  private:
+    Precision d_precision;
+    bool d_tensors;
+    int d_devNumber;
+    const char *d_kernelFile;
+    bool d_pipelined;
+    bool d_vectorCompare;
+    bool d_checksumCompare;
+    bool d_graph;
+    bool d_capturing = false;
+    MemPattern d_memPattern;
+    bool d_memOnly;
+    P2PGroup *d_p2p;
+    std::chrono::seconds d_stopTimeout;
+    int d_sharedBy; // Clients on this device
+    bool d_pcie;
+    bool d_latency;
+    LoadProfile d_profile;
+    Engine d_engine;
+    double d_opsPerMul; // Of a slice
+    size_t d_m, d_n, d_k;
+    size_t d_iters;
+    size_t d_elems; // Per result slice
+    size_t d_resultSize;
+
+    long long int d_error;
+
+    static const int g_blockSize = 16;
+    static const int g_sliceBlockSize = 256;
+    static const size_t g_ltWorkspaceSize = 32ul * 1024 * 1024;
+    static const size_t g_memWordSize = 16; // The uint4 of the mem kernels
+
+    CUdevice d_dev;
+    CUcontext d_ctx;
+    CUmodule d_module;
+    CUfunction d_function;
+    CUfunction d_initFunction;
+    CUfunction d_sliceFunction;
+    unsigned int d_sliceGridSize;
+    CUfunction d_sumsFunction, d_checkSumsFunction;
+    unsigned int d_sumsGridSize, d_checkSumsGridSize;
+    CUdeviceptr d_sums; // d_n per slice
+    CUdeviceptr d_ref, d_refAbs;
+    // --engine
+    CUfunction d_engineFunction, d_engineCheckFunction;
+    unsigned int d_engineGridSize;
+    CUdeviceptr d_engineAnswer; // Of the first ENGINE_CHECKED elements
+    size_t d_engineChecked;
+
+    std::vector<CUstream> d_streams;
+    std::vector<CUevent> d_streamDone;
+    CUstream d_compareStream;
+    CUevent d_sliceDone;
+    CUevent d_compareDone;
+    CUevent d_graphFork;
+    CUgraphExec d_graphExec = NULL;
+
+    CUdeviceptr d_Cdata;
+    // Of d_Cdata's address range when mapped by mapResults(), else 0
+    size_t d_resultsReserved = 0, d_resultsMapped = 0;
+    CUdeviceptr d_Adata;
+    CUdeviceptr d_Bdata;
+    CUdeviceptr d_faultyElemData; // A FaultLog
+    FaultLog *d_faultyElemsHost;
+
+    CUdeviceptr d_memData;
+    size_t d_memVecs = 0; // 16-byte words
+    unsigned int d_memPasses = 0;
+    unsigned long long d_memSeed = DEFAULT_SEED;
+    CUstream d_memStream;
+    CUfunction d_memWriteFunction, d_memInvertFunction, d_memCheckFunction;
+    unsigned d_memGridSize;
+    CUdeviceptr d_memFaultyData;
+    int *d_memFaultyHost;
+
+    size_t d_p2pMember;
+    size_t d_p2pVecs;
+    size_t d_p2pPasses = 0;
+    CUdeviceptr d_p2pSrc, d_p2pBack;
+    CUstream d_p2pStream;
+    CUevent d_p2pDone;
+    std::vector<size_t> d_links; // Members we send to
+    std::vector<CUevent> d_linkStart, d_linkEnd;
+    CUdeviceptr d_linkFaultyData;
+    int *d_linkFaultyHost;
+
+    // --latency, reused once the round is LATENCY_SETS rounds back
+    LatencyEvents d_latencySets[LATENCY_SETS];
+    LatencyEvents *d_latencySet = NULL; // This round's
+    size_t d_latencyRounds = 0;
+    LatencyHistogram d_gemmLatency, d_compareLatency;
+
+    // --profile
+    CUevent d_gateEvents[PROFILE_DEPTH]; // After the GEMMs queued last
+    size_t d_gated = 0;
+    double d_gateLast = 0.0;
+    std::vector<double> d_phaseTime; // s
+    std::vector<size_t> d_phaseGemms;
+
+    // --pcie, with a set of buffers per stream
+    size_t d_pcieVecs;
+    CUdeviceptr d_pcieDown[2], d_pcieUp[2]; // The device ends
+    unsigned char *d_pcieHost[2];
+    CUstream d_pcieStream[2];
+    CUevent d_pcieMarks[2][3]; // Before, between and after the copies
+    CUevent d_pcieDone[2];
+    CUdeviceptr d_pcieFaultyData;
+    int *d_pcieFaultyHost;
+    std::thread d_pcieThread;
+    std::atomic<bool> d_pcieStop{false};
+    std::atomic<bool> d_pcieFailed{false};
+    std::string d_pcieFailure;
+    // What the copies have done since getPcieRates(), under d_pcieMutex
+    std::mutex d_pcieMutex;
+    double d_pcieBytes = 0.0, d_pcieUpSecs = 0.0, d_pcieDownSecs = 0.0;
+    unsigned int d_pcieUpRate = 0, d_pcieDownRate = 0; // MB/s
+    long long d_pcieErrors = 0;
+
+    std::vector<cublasHandle_t> d_cublas;
+
+    cublasLtHandle_t d_lt;
+    cublasLtMatmulDesc_t d_ltDesc;
+    cublasLtMatrixLayout_t d_ltA, d_ltB, d_ltC;
+    cublasLtMatmulAlgo_t d_ltAlgo;
+    std::vector<CUdeviceptr> d_ltWorkspace;
+};
+
+// Returns the number of devices
+int initCuda() {
+    try {
+        CUresult initResult = cuInit(0);
+        const char *initErrStr = "<unavailable>";
+        if (cuGetErrorString(initResult, &initErrStr) != CUDA_SUCCESS ||
+            initErrStr == nullptr) {
+                initErrStr = "<unavailable>";
+            }
+        fprintf(stderr, "cuInit returned %d (%s)\n", initResult,
+            initErrStr);
+        checkError(initResult);
+    } catch (std::runtime_error e) {
+        fprintf(stderr, "Couldn't init CUDA: %s\n", e.what());
+        return 0;
+    }
+    int deviceCount = 0;
+    checkError(cuDeviceGetCount(&deviceCount));
+
+    if (!deviceCount)
+        throw std::string("No CUDA devices");
+
+#ifdef USEDEV
+    if (USEDEV >= deviceCount)
+        throw std::string("Not enough devices for USEDEV");
+#endif
+
+    return deviceCount;
+}
+
+// What a worker publishes in --threads mode, instead of writing to a pipe.
+// Each slot gets its own cache line so the workers don't contend over them,
+// and the monitor just loads the counters.
+struct alignas(64) WorkerSlot {
+    enum State { RUNNING, FAILED, DONE };
+    std::atomic<unsigned long long> processed{0};
+    std::atomic<unsigned long long> errors{0};
+    std::atomic<unsigned long long> memBytes{0};
+    std::atomic<unsigned int> pcieUp{0}, pcieDown{0}; // MB/s of --pcie
+    std::atomic<int> state{RUNNING};
+    std::atomic<bool> stop{false}; // Set by the monitor
+    // Mismatches the monitor hasn't taken yet, added before their errors
+    std::mutex faultMutex;
+    FaultRecord faults[FAULT_LOG_SIZE];
+    size_t faultCount = 0;
+};
+
+// The slots are over-aligned, which new doesn't honour before C++17
+WorkerSlot *allocSlots(size_t count) {
+    void *mem;
+    if (posix_memalign(&mem, alignof(WorkerSlot), count * sizeof(WorkerSlot)))
+        throw std::bad_alloc();
+    WorkerSlot *slots = (WorkerSlot *)mem;
+    for (size_t i = 0; i < count; ++i)
+        new (slots + i) WorkerSlot();
+    return slots;
+}
+
+// Runs the burn on GPU index, reporting to writeFd.  In --threads mode it
+// reports to slot instead, and returns rather than exits when it fails.
+template <class T>
+void startBurn(int index, int writeFd, const BurnConfig &config,
+               WorkerSlot *slot = NULL) {
+    GPU_Test<T> *our;
+    try {
+        our = new GPU_Test<T>(index, config);
+        our->initBuffers(config.useBytes, config.seed);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "Couldn't init a GPU test: %s\n", e.what());
+        if (config.p2pGroup)
+            config.p2pGroup->fail(index);
+        if (slot) {
+            slot->state = WorkerSlot::FAILED;
+            return;
+        }
+        exit(EMEDIUMTYPE);
+    }
+
+    // The actual work
+    try {
+        int eventIndex = 0;
+        const int maxEvents = 2;
+        CUevent events[maxEvents], roundStart[maxEvents];
+        for (int i = 0; i < maxEvents; ++i) {
+            cuEventCreate(events + i,
+                          config.blockingSync ? CU_EVENT_BLOCKING_SYNC : 0);
+            cuEventCreate(roundStart + i, 0);
+        }
+        // GPU time of a round against the host time it takes to issue it,
+        // to see what launch gaps the graph mode saves
+        double gpuTime = 0.0, issueTime = 0.0;
+        size_t timedRounds = 0;
+
+        // Threads share the process, so only count our own CPU time
+        const int usageOf = slot ? RUSAGE_THREAD : RUSAGE_SELF;
+        double startTime = getTime();
+        struct rusage startUsage;
+        getrusage(usageOf, &startUsage);
+
+        int nonWorkIters = maxEvents;
+
+        while (our->shouldRun() && !(slot && slot->stop)) {
+            checkError(cuEventRecord(roundStart[eventIndex], 0),
+                       "Record event");
+            double issueStart = getTime();
+            our->round();
+            double issued = getTime() - issueStart;
+            checkError(cuEventRecord(events[eventIndex], 0), "Record event");
+
+            eventIndex = ++eventIndex % maxEvents;
+
+            if (config.blockingSync)
+                checkError(cuEventSynchronize(events[eventIndex]),
+                           "Sync event");
+            else
+                while (cuEventQuery(events[eventIndex]) != CUDA_SUCCESS)
+                    usleep(1000);
+
+            if (--nonWorkIters > 0)
+                continue;
+
+            float roundMs;
+            if (cuEventElapsedTime(&roundMs, roundStart[eventIndex],
+                                   events[eventIndex]) == CUDA_SUCCESS) {
+                gpuTime += roundMs / 1000.0;
+                issueTime += issued;
+                ++timedRounds;
+            }
+
+            std::vector<FaultRecord> faults;
+            our->getFaults(faults);
+            unsigned int pcieUp, pcieDown;
+            our->getPcieRates(pcieUp, pcieDown);
+            if (slot) {
+                slot->pcieUp = pcieUp;
+                slot->pcieDown = pcieDown;
+                {
+                    std::lock_guard<std::mutex> lock(slot->faultMutex);
+                    for (size_t f = 0; f < faults.size() &&
+                                       slot->faultCount < FAULT_LOG_SIZE;
+                         ++f)
+                        slot->faults[slot->faultCount++] = faults.at(f);
+                }
+                slot->processed.fetch_add(our->getIters(),
+                                          std::memory_order_relaxed);
+                slot->errors.fetch_add(our->getErrors(),
+                                       std::memory_order_relaxed);
+                slot->memBytes.fetch_add(our->getMemBytes(),
+                                         std::memory_order_relaxed);
+                continue;
+            }
+            int ops = our->getIters();
+            write(writeFd, &ops, sizeof(int));
+            ops = our->getErrors();
+            write(writeFd, &ops, sizeof(int));
+            ops = our->getMemBytes() >> 20; // MiB
+            write(writeFd, &ops, sizeof(int));
+            write(writeFd, &pcieUp, sizeof(int));
+            write(writeFd, &pcieDown, sizeof(int));
+            // And the mismatches, at most FAULT_LOG_SIZE of them
+            ops = faults.size();
+            write(writeFd, &ops, sizeof(int));
+            if (ops)
+                write(writeFd, faults.data(), sizeof(FaultRecord) * ops);
+        }
+
+        for (int i = 0; i < maxEvents; ++i)
+            cuEventSynchronize(events[i]);
+
+        struct rusage endUsage;
+        getrusage(usageOf, &endUsage);
+        printf("Host CPU usage for dev %d: %.1f%% of a core (%s)\n", index,
+               (cpuSeconds(endUsage) - cpuSeconds(startUsage)) /
+                   (getTime() - startTime) * 100.0,
+               config.blockingSync ? "blocking sync" : "polling");
+        if (timedRounds)
+            printf("Rounds on dev %d: %.3f ms on the GPU, %.3f ms to issue "
+                   "(%s)\n",
+                   index, gpuTime / timedRounds * 1000.0,
+                   issueTime / timedRounds * 1000.0,
+                   config.graph ? "graph" : "streams");
+        our->reportLatency();
+        our->reportProfile();
+        delete our;
+        if (slot)
+            slot->state = WorkerSlot::DONE;
+    } catch (const std::exception &e) {
+        fprintf(stderr, "Failure during compute: %s\n", e.what());
+        if (config.p2pGroup)
+            config.p2pGroup->fail(index);
+        if (slot) {
+            slot->state = WorkerSlot::FAILED;
+            return;
+        }
+        int ops = -1;
+        // Signalling that we failed
+        for (int i = 0; i < 6; ++i)
+            write(writeFd, &ops, sizeof(int));
+        exit(ECONNREFUSED);
+    }
+}
 
 int pollTemp(pid_t *p) {
     int tempPipe[2];
@@ -452,221 +2366,2049 @@ void updateTemps(int handle, std::vector<int> *temps) {
 #endif
 }
 
-void listenClients(std::vector<int> clientFd, std::vector<pid_t> clientPid,
-                   int runTime, std::chrono::seconds sigterm_timeout_threshold_secs) {
-    fd_set waitHandles;
+// What the NVML sampler last read from a GPU, zeroes if unknown
+struct GpuSample {
+    int temp = 0;                    // C
+    unsigned power = 0;              // mW
+    unsigned smClock = 0;            // MHz
+    unsigned memClock = 0;           // MHz
+    unsigned long long throttle = 0; // nvmlClocksThrottleReasons bits
+    // Volatile ECC counts, since the driver loaded
+    unsigned long long eccCorrected = 0, eccUncorrected = 0;
+    bool ecc = false;  // Has ECC counts
+    unsigned xids = 0; // Critical XID events since the sampler started
+    unsigned xid = 0;  // and the last one's code
+    bool valid = false;
+};
 
-    pid_t tempPid;
-    int tempHandle = pollTemp(&tempPid);
-    int maxHandle = tempHandle;
+// The throttle reasons that hold the clocks below what the load asks for,
+// as opposed to an idle GPU or clocks set on purpose
+#define THROTTLE_LIMITS 0xecULL
 
-    FD_ZERO(&waitHandles);
-    FD_SET(tempHandle, &waitHandles);
+// Names of the nvmlClocksThrottleReasons bits in mask, "none" if none
+std::string throttleNames(unsigned long long mask) {
+    const char *names[] = {"idle",        "app clocks", "power cap",
+                           "hw slowdown", "sync boost", "sw thermal",
+                           "hw thermal",  "power brake", "display clock"};
+    std::string list;
+    for (size_t b = 0; b < sizeof(names) / sizeof(names[0]); ++b)
+        if (mask & (1ULL << b))
+            list += (list.empty() ? "" : ", ") + std::string(names[b]);
+    return list.empty() ? "none" : list;
+}
 
-    for (size_t i = 0; i < clientFd.size(); ++i) {
-        if (clientFd.at(i) > maxHandle)
-            maxHandle = clientFd.at(i);
-        FD_SET(clientFd.at(i), &waitHandles);
+// What NVML saw go wrong on a GPU during the burn, "" if nothing
+std::string eventNote(unsigned long long corrected,
+                      unsigned long long uncorrected, unsigned xids,
+                      unsigned lastXid) {
+    char note[128] = "";
+    if (corrected || uncorrected)
+        snprintf(note, sizeof(note), "%llu corrected and %llu uncorrected ECC "
+                 "errors", corrected, uncorrected);
+    if (xids) {
+        size_t len = strlen(note);
+        if (xids > 1)
+            snprintf(note + len, sizeof(note) - len, "%s%u XIDs, last %u",
+                     len ? ", " : "", xids, lastXid);
+        else
+            snprintf(note + len, sizeof(note) - len, "%sXID %u",
+                     len ? ", " : "", lastXid);
     }
+    return note;
+}
 
-    std::vector<int> clientTemp;
-    std::vector<int> clientErrors;
-    std::vector<int> clientCalcs;
-    std::vector<struct timespec> clientUpdateTime;
-    std::vector<float> clientGflops;
-    std::vector<bool> clientFaulty;
+// Samples the GPUs from a thread in the parent.  libnvidia-ml is loaded at
+// runtime, so gpu-burn still runs where it isn't installed and falls back
+// to polling nvidia-smi.
+class NvmlSampler {
+    // Just what we use of nvml.h, the ABI of these hasn't changed
+    typedef int (*InitFn)();
+    typedef int (*HandleFn)(const char *, void **);
+    typedef int (*TempFn)(void *, int, unsigned *);
+    typedef int (*UintFn)(void *, unsigned *);
+    typedef int (*ClockFn)(void *, int, unsigned *);
+    typedef int (*ThrottleFn)(void *, unsigned long long *);
+    typedef int (*EccFn)(void *, int, int, unsigned long long *);
+    typedef int (*EventSetFn)(void **);
+    typedef int (*EventSetFreeFn)(void *);
+    typedef int (*RegisterFn)(void *, unsigned long long, void *);
+    struct EventData {
+        void *device;
+        unsigned long long eventType, eventData;
+        unsigned gpuInstanceId, computeInstanceId;
+    };
+    typedef int (*WaitFn)(void *, EventData *, unsigned);
+    enum { NVML_TEMPERATURE_GPU = 0, NVML_CLOCK_SM = 1, NVML_CLOCK_MEM = 2 };
+    enum { NVML_MEMORY_ERROR_TYPE_CORRECTED = 0, NVML_VOLATILE_ECC = 0 };
+    enum { NVML_MEMORY_ERROR_TYPE_UNCORRECTED = 1 };
+    enum { NVML_EVENT_XID_CRITICAL_ERROR = 8, NVML_ERROR_TIMEOUT = 10 };
 
-    time_t startTime = time(0);
+  public:
+    ~NvmlSampler() { stop(); }
 
-    for (size_t i = 0; i < clientFd.size(); ++i) {
-        clientTemp.push_back(0);
-        clientErrors.push_back(0);
-        clientCalcs.push_back(0);
-        struct timespec thisTime;
-        clock_gettime(CLOCK_REALTIME, &thisTime);
+    // Devices are CUDA ordinals, matched to NVML handles by PCI bus ID
+    // since the two don't necessarily enumerate in the same order.  With
+    // --mig they're matched by the UUIDs of their GPUs instead, which the
+    // parent's CUDA doesn't see.
+    bool start(const std::vector<int> &devices, int periodMs,
+               const std::vector<std::string> &uuids) {
+        d_lib = dlopen("libnvidia-ml.so.1", RTLD_NOW);
+        if (!d_lib)
+            return false;
+
+        InitFn init = (InitFn)dlsym(d_lib, "nvmlInit_v2");
+        HandleFn getHandle =
+            (HandleFn)dlsym(d_lib, "nvmlDeviceGetHandleByPciBusId_v2");
+        HandleFn getHandleByUuid =
+            (HandleFn)dlsym(d_lib, "nvmlDeviceGetHandleByUUID");
+        d_shutdown = (InitFn)dlsym(d_lib, "nvmlShutdown");
+        d_getTemp = (TempFn)dlsym(d_lib, "nvmlDeviceGetTemperature");
+        d_getPower = (UintFn)dlsym(d_lib, "nvmlDeviceGetPowerUsage");
+        d_getClock = (ClockFn)dlsym(d_lib, "nvmlDeviceGetClockInfo");
+        d_getThrottle = (ThrottleFn)dlsym(
+            d_lib, "nvmlDeviceGetCurrentClocksThrottleReasons");
+        d_getEcc = (EccFn)dlsym(d_lib, "nvmlDeviceGetTotalEccErrors");
+        EventSetFn createEvents =
+            (EventSetFn)dlsym(d_lib, "nvmlEventSetCreate");
+        RegisterFn registerEvents =
+            (RegisterFn)dlsym(d_lib, "nvmlDeviceRegisterEvents");
+        d_freeEvents = (EventSetFreeFn)dlsym(d_lib, "nvmlEventSetFree");
+        d_waitEvents = (WaitFn)dlsym(d_lib, "nvmlEventSetWait_v2");
+        if (!d_waitEvents)
+            d_waitEvents = (WaitFn)dlsym(d_lib, "nvmlEventSetWait");
+        if (!init || !getHandle || !d_shutdown || !d_getTemp || init()) {
+            dlclose(d_lib);
+            d_lib = NULL;
+            return false;
+        }
+
+        // The children have their contexts by now, so it's safe for the
+        // parent to init CUDA for the bus IDs
+        if (uuids.empty() && cuInit(0) != CUDA_SUCCESS) {
+            stop();
+            return false;
+        }
+        for (size_t i = 0; i < devices.size(); ++i) {
+            char busId[32];
+            CUdevice dev;
+            void *handle = NULL;
+            if (!uuids.empty()) {
+                if (!getHandleByUuid ||
+                    getHandleByUuid(uuids.at(i).c_str(), &handle)) {
+                    fprintf(stderr, "No NVML handle for GPU %d\n",
+                            devices.at(i));
+                    handle = NULL;
+                }
+            } else if (cuDeviceGet(&dev, devices.at(i)) != CUDA_SUCCESS ||
+                cuDeviceGetPCIBusId(busId, sizeof(busId), dev) !=
+                    CUDA_SUCCESS ||
+                getHandle(busId, &handle)) {
+                fprintf(stderr, "No NVML handle for GPU %d\n", devices.at(i));
+                handle = NULL;
+            }
+            d_handles.push_back(handle);
+        }
+        d_samples.resize(devices.size());
+
+        // The XIDs come as events, which the sampler waits for in between
+        // samples.  MIG instances of a GPU share its handle, and its events.
+        if (createEvents && registerEvents && d_freeEvents && d_waitEvents &&
+            !createEvents(&d_events)) {
+            bool registered = false;
+            for (size_t i = 0; i < d_handles.size(); ++i)
+                if (d_handles.at(i) &&
+                    std::find(d_handles.begin(), d_handles.begin() + i,
+                              d_handles.at(i)) == d_handles.begin() + i &&
+                    !registerEvents(d_handles.at(i),
+                                    NVML_EVENT_XID_CRITICAL_ERROR, d_events))
+                    registered = true;
+            if (!registered) {
+                d_freeEvents(d_events);
+                d_events = NULL;
+            }
+        }
+        if (d_profile.shape != PROFILE_FLAT) {
+            d_phasePower.assign(devices.size(),
+                                std::vector<double>(d_profile.phases()));
+            d_phaseSamples.assign(devices.size(),
+                                  std::vector<size_t>(d_profile.phases()));
+        }
+
+        d_running = true;
+        d_thread = std::thread(&NvmlSampler::run, this, periodMs);
+        return true;
+    }
+
+    void stop() {
+        if (d_running) {
+            d_running = false;
+            d_thread.join();
+        }
+        if (d_events) {
+            d_freeEvents(d_events);
+            d_events = NULL;
+        }
+        if (d_lib) {
+            d_shutdown();
+            dlclose(d_lib);
+            d_lib = NULL;
+        }
+    }
+
+    GpuSample get(size_t i) {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        return d_samples.at(i);
+    }
+
+    // Has the power averaged by the phase of the profile it's sampled in,
+    // before start()
+    void setProfile(const LoadProfile &profile) { d_profile = profile; }
+
+    // The mean W of GPU i in phase p of the profile, -1 if never sampled
+    double phasePower(size_t i, int p) {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        if (i >= d_phaseSamples.size() || !d_phaseSamples.at(i).at(p))
+            return -1.0;
+        return d_phasePower.at(i).at(p) / d_phaseSamples.at(i).at(p) / 1000.0;
+    }
+
+  private:
+    void run(int periodMs) {
+        while (d_running) {
+            for (size_t i = 0; i < d_handles.size(); ++i) {
+                void *handle = d_handles.at(i);
+                if (!handle)
+                    continue;
+                GpuSample s;
+                unsigned temp;
+                if (!d_getTemp(handle, NVML_TEMPERATURE_GPU, &temp))
+                    s.temp = temp;
+                // The rest is optional, depending on the GPU and driver
+                if (d_getPower)
+                    d_getPower(handle, &s.power);
+                if (d_getClock) {
+                    d_getClock(handle, NVML_CLOCK_SM, &s.smClock);
+                    d_getClock(handle, NVML_CLOCK_MEM, &s.memClock);
+                }
+                if (d_getThrottle)
+                    d_getThrottle(handle, &s.throttle);
+                s.ecc = d_getEcc &&
+                        !d_getEcc(handle, NVML_MEMORY_ERROR_TYPE_CORRECTED,
+                                  NVML_VOLATILE_ECC, &s.eccCorrected) &&
+                        !d_getEcc(handle, NVML_MEMORY_ERROR_TYPE_UNCORRECTED,
+                                  NVML_VOLATILE_ECC, &s.eccUncorrected);
+                s.valid = true;
+
+                std::lock_guard<std::mutex> lock(d_mutex);
+                s.xids = d_samples.at(i).xids;
+                s.xid = d_samples.at(i).xid;
+                d_samples.at(i) = s;
+                if (d_profile.shape != PROFILE_FLAT && s.power) {
+                    int p = d_profile.phase(monotonicTime());
+                    d_phasePower.at(i).at(p) += s.power;
+                    ++d_phaseSamples.at(i).at(p);
+                }
+            }
+            waitEvents(periodMs);
+        }
+    }
+
+    // Sleeps for ms, counting the XIDs that come in meanwhile
+    void waitEvents(int ms) {
+        if (!d_events) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            return;
+        }
+        double end = monotonicTime() + ms / 1000.0;
+        for (double left = ms; left > 0.0;
+             left = (end - monotonicTime()) * 1000.0) {
+            EventData event;
+            int result = d_waitEvents(d_events, &event, (unsigned)left);
+            if (result == NVML_ERROR_TIMEOUT)
+                break;
+            if (result) {
+                // Don't spin on a broken event set
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds((int)left));
+                break;
+            }
+            std::lock_guard<std::mutex> lock(d_mutex);
+            for (size_t i = 0; i < d_handles.size(); ++i)
+                if (d_handles.at(i) == event.device) {
+                    ++d_samples.at(i).xids;
+                    d_samples.at(i).xid = (unsigned)event.eventData;
+                }
+        }
+    }
+
+    void *d_lib = NULL;
+    InitFn d_shutdown = NULL;
+    TempFn d_getTemp = NULL;
+    UintFn d_getPower = NULL;
+    ClockFn d_getClock = NULL;
+    ThrottleFn d_getThrottle = NULL;
+    EccFn d_getEcc = NULL;
+    EventSetFreeFn d_freeEvents = NULL;
+    WaitFn d_waitEvents = NULL;
+    void *d_events = NULL; // Of the XIDs
+
+    std::vector<void *> d_handles;
+    std::vector<GpuSample> d_samples;
+    LoadProfile d_profile;
+    std::vector<std::vector<double> > d_phasePower; // mW, summed
+    std::vector<std::vector<size_t> > d_phaseSamples;
+    std::mutex d_mutex;
+    std::thread d_thread;
+    volatile bool d_running = false;
+};
+
+double toSeconds(const struct timespec &t) {
+    return (double)t.tv_sec + (double)t.tv_nsec / 1000000000.0;
+}
+
+// Nearest-rank percentile, sorts the samples
+float percentile(std::vector<float> &samples, double p) {
+    if (samples.empty())
+        return 0.0f;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = (size_t)(p / 100.0 * samples.size() + 0.999999);
+    return samples.at(rank ? rank - 1 : 0);
+}
+
+// --until-stable: the throughput and temperature of a GPU over the last
+// window seconds.  It's steady once the window has filled up, the
+// coefficient of variation of the throughput is below maxCv and the
+// temperature has stayed within STABLE_TEMP_C.
+class StabilityWindow {
+  public:
+    StabilityWindow(double window) : d_window(window) {}
+
+    // A temperature of 0 means we don't know it
+    void add(double t, double value, int temp) {
+        if (d_start < 0.0)
+            d_start = t;
+        d_samples.push_back(Sample{t, value, temp});
+        while (d_samples.front().t < t - d_window)
+            d_samples.pop_front();
+    }
+
+    bool steady(double maxCv) const {
+        if (d_samples.size() < 2 || d_samples.back().t - d_start < d_window)
+            return false;
+        int minTemp = 0, maxTemp = 0;
+        for (size_t s = 0; s < d_samples.size(); ++s) {
+            int temp = d_samples.at(s).temp;
+            if (temp && (!minTemp || temp < minTemp))
+                minTemp = temp;
+            if (temp > maxTemp)
+                maxTemp = temp;
+        }
+        return stddev() < maxCv * mean() &&
+               maxTemp - minTemp <= STABLE_TEMP_C;
+    }
+
+    double mean() const {
+        double sum = 0.0;
+        for (size_t s = 0; s < d_samples.size(); ++s)
+            sum += d_samples.at(s).value;
+        return d_samples.empty() ? 0.0 : sum / d_samples.size();
+    }
+
+    double stddev() const {
+        if (d_samples.size() < 2)
+            return 0.0;
+        double m = mean(), sum = 0.0;
+        for (size_t s = 0; s < d_samples.size(); ++s)
+            sum += (d_samples.at(s).value - m) * (d_samples.at(s).value - m);
+        return sqrt(sum / (d_samples.size() - 1));
+    }
+
+    // Half width of the 95% confidence interval of the mean.  The samples
+    // aren't quite independent, so take it as a lower bound.
+    double ci95() const {
+        return d_samples.empty() ? 0.0
+                                 : 1.96 * stddev() / sqrt(d_samples.size());
+    }
+
+    int temp() const { return d_samples.empty() ? 0 : d_samples.back().temp; }
+
+  private:
+    struct Sample {
+        double t;
+        double value;
+        int temp;
+    };
+    const double d_window;
+    double d_start = -1.0; // Of the first sample
+    std::deque<Sample> d_samples;
+};
+
+// What a GPU settled at with --until-stable
+struct SteadyState {
+    bool reached = false;
+    double after = 0.0; // Seconds into the burn
+    double value = 0.0, ci95 = 0.0;
+    int temp = 0;
+};
+
+// "name, sm_XY" of a CUDA device, which the --baseline is kept by.  The
+// monitor only calls this once the workers have been forked, as it mustn't
+// init CUDA before.
+std::string deviceModel(int ordinal) {
+    CUdevice dev;
+    char name[256];
+    int major, minor;
+    if (cuInit(0) != CUDA_SUCCESS ||
+        cuDeviceGet(&dev, ordinal) != CUDA_SUCCESS ||
+        cuDeviceGetName(name, sizeof(name), dev) != CUDA_SUCCESS ||
+        cuDeviceGetAttribute(&major,
+                             CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR,
+                             dev) != CUDA_SUCCESS ||
+        cuDeviceGetAttribute(&minor,
+                             CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR,
+                             dev) != CUDA_SUCCESS)
+        return "unknown";
+    char model[300];
+    snprintf(model, sizeof(model), "%s, sm_%d%d", name, major, minor);
+    return model;
+}
+
+// What the throughput depends on besides the GPU, for the --baseline
+std::string baselineTest(const BurnConfig &config) {
+    char test[128];
+    if (config.memOnly)
+        snprintf(test, sizeof(test), "mem %s",
+                 g_memPatternNames[config.memPattern]);
+    else
+        snprintf(test, sizeof(test), "%s%s%s%s %zux%zux%zu",
+                 g_precisionNames[config.precision],
+                 config.tensors ? "-tc" : "",
+                 config.engine != ENGINE_CUBLAS ? " " : "",
+                 config.engine != ENGINE_CUBLAS
+                     ? g_engineNames[config.engine]
+                     : "",
+                 config.m, config.n, config.k);
+    // Clients sharing a GPU each get their part of it
+    if (config.mpsClients > 1 || config.mpsPercent) {
+        size_t len = strlen(test);
+        snprintf(test + len, sizeof(test) - len, " mps %dx%d%%",
+                 config.mpsClients,
+                 config.mpsPercent ? config.mpsPercent : 100);
+    }
+    return test;
+}
+
+// The --baseline file has a line per test and GPU model:
+// <throughput> TAB <test> TAB <model>.  They're kept by "test TAB model".
+std::map<std::string, double> readBaseline(const char *path) {
+    std::map<std::string, double> baseline;
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos)
+            continue;
+        baseline[line.substr(tab + 1)] = atof(line.c_str());
+    }
+    return baseline;
+}
+
+void writeBaseline(const char *path,
+                   const std::map<std::string, double> &baseline) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Couldn't write %s: %s\n", path, strerror(errno));
+        return;
+    }
+    fprintf(f, "# gpu-burn baseline: throughput, test, GPU model\n");
+    for (std::map<std::string, double>::const_iterator it = baseline.begin();
+         it != baseline.end(); ++it)
+        fprintf(f, "%.1f\t%s\n", it->second, it->first.c_str());
+    fclose(f);
+}
+
+// Checks what each GPU settled at (values, -1 if it doesn't count) against
+// the --baseline of its model, and against the median of the other GPUs of
+// the same model in this run.  Models the file doesn't have yet are added
+// with the median of this run.  Returns which GPUs were slow.
+std::vector<bool> checkBaseline(const BurnConfig &config,
+                                const std::vector<int> &devices,
+                                const std::vector<double> &values,
+                                const char *unit, FILE *json) {
+    std::map<std::string, double> baseline = readBaseline(config.baseline);
+    const std::string test = baselineTest(config);
+    std::vector<std::string> models;
+    std::map<std::string, std::vector<float> > byModel;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        models.push_back(config.migInstances.empty()
+                             ? deviceModel(devices.at(i))
+                             : config.migInstances.at(i).model);
+        if (values.at(i) >= 0.0)
+            byModel[models.back()].push_back(values.at(i));
+    }
+
+    std::vector<bool> slow(devices.size());
+    printf("\nAgainst the baseline in %s (slow below %.0f%%):\n",
+           config.baseline, config.slowFraction * 100.0);
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (values.at(i) < 0.0) {
+            printf("\tGPU %d: --\n", (int)i);
+            continue;
+        }
+        std::map<std::string, double>::const_iterator base =
+            baseline.find(test + "\t" + models.at(i));
+        std::vector<float> peers = byModel[models.at(i)];
+        peers.erase(
+            std::find(peers.begin(), peers.end(), (float)values.at(i)));
+        double ofBase = base != baseline.end() && base->second > 0.0
+                            ? values.at(i) / base->second
+                            : 0.0;
+        double ofPeers = peers.empty() ? 0.0
+                                       : values.at(i) / percentile(peers, 50.0);
+        slow.at(i) = (ofBase && ofBase < config.slowFraction) ||
+                     (ofPeers && ofPeers < config.slowFraction);
+
+        printf("\tGPU %d: %9.1f %s", (int)i, values.at(i), unit);
+        if (ofBase)
+            printf(", %.0f%% of the baseline", ofBase * 100.0);
+        if (ofPeers)
+            printf(", %.0f%% of its peers", ofPeers * 100.0);
+        printf("%s (%s)\n", slow.at(i) ? "  SLOW" : "", models.at(i).c_str());
+        if (json)
+            fprintf(json,
+                    "{\"baseline\":true,\"gpu\":%zu,\"model\":\"%s\","
+                    "\"value\":%.1f,\"of_baseline\":%.3f,\"of_peers\":%.3f,"
+                    "\"slow\":%s}\n",
+                    i, models.at(i).c_str(), values.at(i), ofBase, ofPeers,
+                    slow.at(i) ? "true" : "false");
+    }
+
+    bool changed = false;
+    for (std::map<std::string, std::vector<float> >::iterator it =
+             byModel.begin();
+         it != byModel.end(); ++it) {
+        std::string key = test + "\t" + it->first;
+        if (!baseline.count(key) || config.baselineUpdate) {
+            baseline[key] = percentile(it->second, 50.0);
+            printf("\tRecording %.1f %s for %s\n", baseline[key], unit,
+                   it->first.c_str());
+            changed = true;
+        }
+    }
+    if (changed)
+        writeBaseline(config.baseline, baseline);
+    return slow;
+}
+
+// --coordinator and --agent: the agents of a cluster connect over TCP, are
+// started together at a wall clock time the coordinator sends them, and
+// then stream it a line per GPU and report:
+//   hello <host>                                      to the coordinator
+//   start <s since the epoch>                         to the agent
+//   r <gpu> <iters> <Gflop/s> <errors> <C> <W>        per report
+//   d <gpu> <OK|FAULTY|SLOW> <mean Gflop/s> <errors> <model>  at the end
+// The agents' load --profile steps from the start, so their clocks need to
+// be in sync (NTP) for the steps to line up.
+
+// Sends a line to the coordinator, if we've got one.  It going away
+// doesn't stop the burn.
+void agentSend(int fd, const char *format, ...) {
+    if (fd == -1)
+        return;
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0)
+        send(fd, line, std::min((size_t)len, sizeof(line) - 1), MSG_NOSIGNAL);
+}
+
+// A TCP socket connected to host:port, or listening on port if host is
+// NULL.  -1 if there's none to be had.
+int openSocket(const char *host, const char *port) {
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = host ? 0 : AI_PASSIVE;
+    if (getaddrinfo(host, port, &hints, &addrs))
+        return -1;
+    int fd = -1;
+    for (struct addrinfo *a = addrs; a && fd == -1; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd == -1)
+            continue;
+        int one = 1;
+        if (!host)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (host ? connect(fd, a->ai_addr, a->ai_addrlen)
+                 : bind(fd, a->ai_addr, a->ai_addrlen) ||
+                       listen(fd, SOMAXCONN)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+// Reads up to a newline, false if the connection closed or timed out first
+bool readLine(int fd, std::string &line) {
+    line.clear();
+    char c;
+    while (read(fd, &c, 1) == 1)
+        if (c == '\n')
+            return true;
+        else
+            line += c;
+    return false;
+}
+
+// --daemon: serves the text the monitor last published on /metrics, in
+// Prometheus' format.  A scrape only copies it.
+class MetricsServer {
+  public:
+    ~MetricsServer() { stop(); }
+
+    // Called before the workers are forked, so that a port in use fails
+    // the start
+    bool listen(int port) {
+        char service[16];
+        snprintf(service, sizeof(service), "%d", port);
+        d_fd = openSocket(NULL, service);
+        return d_fd != -1;
+    }
+
+    // ...and the thread only once they are
+    void start() { d_thread = std::thread(&MetricsServer::run, this); }
+
+    void stop() {
+        if (!d_thread.joinable())
+            return;
+        d_stop = true;
+        d_thread.join();
+        close(d_fd);
+    }
+
+    void publish(const std::string &text) {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_text = text;
+    }
+
+  private:
+    void run() {
+        while (!d_stop) {
+            fd_set waitHandles;
+            FD_ZERO(&waitHandles);
+            FD_SET(d_fd, &waitHandles);
+            struct timeval wait = {0, 100000};
+            if (select(d_fd + 1, &waitHandles, NULL, NULL, &wait) <= 0)
+                continue;
+            int fd = accept(d_fd, NULL, NULL);
+            if (fd == -1)
+                continue;
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    // Reads the request up to the end of its headers, only its first line
+    // matters
+    void serve(int fd) {
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[2048];
+        size_t len = 0;
+        ssize_t got;
+        while (len < sizeof(request) - 1 &&
+               (got = read(fd, request + len, sizeof(request) - 1 - len)) > 0) {
+            len += got;
+            request[len] = 0;
+            if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+                break;
+        }
+        request[len] = 0;
+
+        std::string body;
+        const char *status = "200 OK";
+        if (!strncmp(request, "GET /metrics ", 13) ||
+            !strncmp(request, "GET / ", 6)) {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            body = d_text;
+        } else {
+            status = "404 Not Found";
+            body = "Try /metrics\n";
+        }
+        char header[256];
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                 status, body.size());
+        std::string response = header + body;
+        for (size_t sent = 0; sent < response.size();) {
+            ssize_t res = send(fd, response.data() + sent,
+                               response.size() - sent, MSG_NOSIGNAL);
+            if (res <= 0)
+                break;
+            sent += res;
+        }
+    }
+
+    int d_fd = -1;
+    std::thread d_thread;
+    std::atomic<bool> d_stop{false};
+    std::mutex d_mutex;
+    std::string d_text;
+};
+
+// A metric of each GPU in Prometheus' text format, leaving out the NaNs of
+// those we don't know yet
+void addMetric(std::string &text, const char *name, const char *type,
+               const char *help, const std::vector<double> &values) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help,
+             name, type);
+    text += line;
+    for (size_t i = 0; i < values.size(); ++i)
+        if (!std::isnan(values.at(i))) {
+            snprintf(line, sizeof(line), "%s{gpu=\"%zu\"} %.15g\n", name, i,
+                     values.at(i));
+            text += line;
+        }
+}
+
+void requestStop(int) { g_stopRequested = 1; }
+
+// Opens the --json-out file with a large buffer, records are only flushed
+// at the periodic summaries and at the end
+FILE *openJson(const char *path) {
+    if (!path)
+        return NULL;
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+        exit(errno);
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 16);
+    return f;
+}
+
+// Asks the --threads workers to stop after their current round and waits up
+// to timeout for them.  There's nothing to SIGKILL, a stuck worker dies with
+// the process.
+void stopThreads(WorkerSlot *slots, size_t count,
+                 std::chrono::seconds timeout) {
+    printf("\nStopping worker threads\n");
+    fflush(stdout);
+    for (size_t i = 0; i < count; ++i)
+        slots[i].stop = true;
+
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + timeout;
+    for (size_t i = 0; i < count; ++i)
+        while (slots[i].state == WorkerSlot::RUNNING) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                printf("\nWorker %zu didn't stop in time\n", i);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+}
+
+// Keeps the first FAULTS_KEPT mismatches of a GPU
+void keepFaults(std::vector<FaultRecord> &kept, const FaultRecord *faults,
+                size_t count) {
+    for (size_t f = 0; f < count && kept.size() < FAULTS_KEPT; ++f)
+        kept.push_back(faults[f]);
+}
+
+// Lists where the mismatches of a GPU were, for telling a bad SM from bad
+// memory.  C is column major, m rows high.
+void reportFaults(size_t gpu, const std::vector<FaultRecord> &faults,
+                  long long errors, const BurnConfig &config, FILE *json) {
+    if (faults.empty())
+        return;
+    printf("\nMismatches on GPU %zu (%zu logged of %lld errors):\n", gpu,
+           faults.size(), errors);
+    for (size_t f = 0; f < faults.size(); ++f) {
+        const FaultRecord &r = faults.at(f);
+        unsigned long long row = r.index % config.m, col = r.index / config.m;
+        char rowText[32] = "null";
+        if (!config.checksumCompare)
+            snprintf(rowText, sizeof(rowText), "%llu", row);
+        if (f < FAULTS_PRINTED && config.checksumCompare) {
+            // These are the column sums, as doubles
+            double expected, got;
+            memcpy(&expected, &r.expected, sizeof(double));
+            memcpy(&got, &r.got, sizeof(double));
+            printf("\tslice %u, col %llu: sum %.10g, expected %.10g, SM %u\n",
+                   r.slice, col, got, expected, r.sm);
+        } else if (f < FAULTS_PRINTED)
+            printf("\tslice %u, row %llu, col %llu: expected 0x%llx, got "
+                   "0x%llx (xor 0x%llx), SM %u\n",
+                   r.slice, row, col, r.expected, r.got, r.expected ^ r.got,
+                   r.sm);
+        if (json)
+            fprintf(json,
+                    "{\"fault\":true,\"gpu\":%zu,\"slice\":%u,\"row\":%s,"
+                    "\"col\":%llu,\"expected\":\"0x%llx\",\"got\":\"0x%llx\","
+                    "\"sm\":%u,\"gpu_time_ns\":%llu}\n",
+                    gpu, r.slice, rowText, col, r.expected, r.got, r.sm,
+                    r.time);
+    }
+    if (faults.size() > FAULTS_PRINTED)
+        printf("\t... %zu more%s\n", faults.size() - FAULTS_PRINTED,
+               json ? " in the JSON output" : "");
+}
+
+// Prints the --p2p link table, and adds it to the JSON records.  At the end
+// (final) the links are also judged.
+void reportLinks(P2PGroup *group, FILE *json, double ts, bool final) {
+    const size_t members = group->devices.size();
+    for (size_t from = 0; from < members; ++from)
+        for (size_t to = 0; to < members; ++to) {
+            if (!group->sends(from, to))
+                continue;
+            LinkStats link = group->link(from, to);
+            double gbps =
+                link.seconds > 0.0 ? link.bytes / link.seconds / 1e9 : 0.0;
+            printf("\tLink %d -> %d: %6.1f GB/s, %llu errors%s\n",
+                   group->devices.at(from), group->devices.at(to), gbps,
+                   link.errors,
+                   final ? (link.errors ? " FAULTY" : " OK") : "");
+            if (json)
+                fprintf(json,
+                        "{%s\"ts\":%.3f,\"link_from\":%d,\"link_to\":%d,"
+                        "\"bytes\":%.0f,\"gbps\":%.2f,\"errors\":%llu}\n",
+                        final ? "\"summary\":true," : "", ts,
+                        group->devices.at(from), group->devices.at(to),
+                        link.bytes, gbps, link.errors);
+        }
+}
+
+// Gives the SIGTERMed children up to timeout to exit, without reaping them
+void waitChildren(const std::vector<pid_t> &pids,
+                  std::chrono::seconds timeout) {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + timeout;
+    for (size_t i = 0; i < pids.size(); ++i)
+        for (;;) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_PID, pids.at(i), &info, WEXITED | WNOHANG | WNOWAIT) ||
+                info.si_pid || std::chrono::steady_clock::now() > deadline)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+}
+
+// Collects the reports of the workers, from their pipes or, in --threads
+// mode, from their slots.  Returns the exit status for --fail-fast and
+// --baseline, with bit d set if GPU d failed or was slow (GPUs past the 8th
+// share the last bit).
+int listenClients(std::vector<int> clientFd, std::vector<pid_t> clientPid,
+                   int runTime, std::chrono::seconds sigterm_timeout_threshold_secs,
+                   const BurnConfig &config, const std::vector<int> &devices,
+                   WorkerSlot *slots = NULL) {
+    const size_t clients = devices.size();
+    const double opsPerMul = config.opsPerMul();
+    FILE *json = openJson(config.jsonOut);
+    fd_set waitHandles;
+
+    // NVML if we've got it, else the temperatures from nvidia-smi
+    NvmlSampler sampler;
+    std::vector<std::string> gpuUuids;
+    for (size_t i = 0; i < config.migInstances.size(); ++i)
+        gpuUuids.push_back(config.migInstances.at(i).gpuUuid);
+    sampler.setProfile(config.profile);
+    bool nvml = sampler.start(devices, config.sampleMs, gpuUuids);
+    pid_t tempPid = 0;
+    int tempHandle = nvml ? -1 : pollTemp(&tempPid);
+    // A --daemon is stopped with a signal, which has it report as at the
+    // end of a run
+    if (config.metrics) {
+        config.metrics->start();
+        signal(SIGTERM, requestStop);
+        signal(SIGINT, requestStop);
+    }
+    int maxHandle = tempHandle;
+
+    FD_ZERO(&waitHandles);
+    if (tempHandle != -1)
+        FD_SET(tempHandle, &waitHandles);
+
+    for (size_t i = 0; i < clientFd.size(); ++i) {
+        if (clientFd.at(i) > maxHandle)
+            maxHandle = clientFd.at(i);
+        FD_SET(clientFd.at(i), &waitHandles);
+    }
+
+    std::vector<int> clientTemp;
+    std::vector<long long> clientErrors;
+    std::vector<long long> clientCalcs;
+    std::vector<struct timespec> clientUpdateTime;
+    std::vector<float> clientGflops;
+    std::vector<float> clientGbps(clients); // Of the memory burn
+    // Of --pcie, up to the device and down to the host, and their sums
+    // over the reports after the first
+    std::vector<float> clientPcieUp(clients), clientPcieDown(clients);
+    std::vector<double> clientPcieUpSum(clients), clientPcieDownSum(clients);
+    std::vector<bool> clientFaulty;
+    std::vector<long long> clientTotalErrors;
+    std::vector<std::vector<float> > clientSamples;
+    std::vector<GpuSample> clientSensors(clients);
+    // Summed over the reports after the first, for the power and clocks
+    // the engine ran at
+    std::vector<double> clientPowerSum(clients), clientClockSum(clients);
+    std::vector<double> clientPerMhzSum(clients);
+    std::vector<size_t> clientSensorReports(clients);
+    // ... and the reports the clocks were held back in, for which reasons
+    std::vector<size_t> clientThrottled(clients);
+    std::vector<unsigned long long> clientThrottleSeen(clients);
+    // The sample at the last report, which the ECC and XID counts of each
+    // report's interval are taken from, and their sums
+    std::vector<GpuSample> clientLastSensors(clients);
+    std::vector<unsigned long long> clientEccCorrected(clients),
+        clientEccUncorrected(clients);
+    std::vector<unsigned> clientXids(clients), clientLastXid(clients);
+    std::vector<size_t> clientFlagged(clients); // Reports with any of them
+    std::vector<std::vector<FaultRecord> > clientFaults(clients);
+    // Seconds into the burn of the first error, -1 for none.  With
+    // --fail-fast the GPU is stopped then.
+    std::vector<double> clientFirstError(clients, -1.0);
+    std::vector<bool> clientStopped(clients);
+    std::vector<StabilityWindow> clientWindow(
+        clients, StabilityWindow(config.stableWindow));
+    std::vector<SteadyState> clientSteady(clients);
+    // Of Gflop/s, or GB/s with --mem, for the --baseline
+    std::vector<double> clientThroughput(clients);
+    // The memory burn on its own doesn't do flops
+    const char *unit = config.memOnly ? "GB/s" : "Gflop/s";
+    // What we've already accounted for of the slot counters
+    std::vector<unsigned long long> slotProcessed(clients), slotErrors(clients),
+        slotMemBytes(clients);
+
+    time_t startTime = time(0);
+    struct timespec startTimeSpec;
+    clock_gettime(CLOCK_REALTIME, &startTimeSpec);
+
+    for (size_t i = 0; i < clients; ++i) {
+        clientTemp.push_back(0);
+        clientErrors.push_back(0);
+        clientCalcs.push_back(0);
+        struct timespec thisTime;
+        clock_gettime(CLOCK_REALTIME, &thisTime);
         clientUpdateTime.push_back(thisTime);
         clientGflops.push_back(0.0f);
         clientFaulty.push_back(false);
+        clientTotalErrors.push_back(0);
+        clientSamples.push_back(std::vector<float>());
     }
 
     int changeCount;
     float nextReport = 10.0f;
     bool childReport = false;
-    while (
-        (changeCount = select(maxHandle + 1, &waitHandles, NULL, NULL, NULL))) {
+    while (true) {
+        // The slots don't wake us up, so look at them every SLOT_POLL_MS
+        struct timeval slotPoll = {0, SLOT_POLL_MS * 1000};
+        changeCount = select(maxHandle + 1, &waitHandles, NULL, NULL,
+                             slots ? &slotPoll : NULL);
+        if (g_stopRequested) {
+            printf("\n\nStopped by a signal\n");
+            break;
+        }
+        if (!changeCount && !slots)
+            break;
         size_t thisTime = time(0);
         struct timespec thisTimeSpec;
         clock_gettime(CLOCK_REALTIME, &thisTimeSpec);
 
+        if (nvml)
+            for (size_t i = 0; i < clients; ++i) {
+                clientSensors.at(i) = sampler.get(i);
+                clientTemp.at(i) = clientSensors.at(i).temp;
+            }
+
         // Going through all descriptors
-        for (size_t i = 0; i < clientFd.size(); ++i)
-            if (FD_ISSET(clientFd.at(i), &waitHandles)) {
+        for (size_t i = 0; i < clients; ++i) {
+            if (clientStopped.at(i))
+                continue;
+            long long processed, errors;
+            double memBytes;
+            if (slots) {
+                if (clientCalcs.at(i) == -1)
+                    continue;
+                unsigned long long p = slots[i].processed;
+                unsigned long long e = slots[i].errors;
+                unsigned long long m = slots[i].memBytes;
+                if (slots[i].state == WorkerSlot::FAILED)
+                    processed = errors = memBytes = -1;
+                else if (p == slotProcessed.at(i) && e == slotErrors.at(i) &&
+                         m == slotMemBytes.at(i))
+                    continue;
+                else {
+                    std::lock_guard<std::mutex> lock(slots[i].faultMutex);
+                    keepFaults(clientFaults.at(i), slots[i].faults,
+                               slots[i].faultCount);
+                    slots[i].faultCount = 0;
+                    processed = p - slotProcessed.at(i);
+                    errors = e - slotErrors.at(i);
+                    memBytes = m - slotMemBytes.at(i);
+                    clientPcieUp.at(i) = slots[i].pcieUp / 1000.0f;
+                    clientPcieDown.at(i) = slots[i].pcieDown / 1000.0f;
+                    slotProcessed.at(i) = p;
+                    slotErrors.at(i) = e;
+                    slotMemBytes.at(i) = m;
+                }
+            } else if (FD_ISSET(clientFd.at(i), &waitHandles)) {
                 // First, reading processed
-                int processed, errors;
-                int res = read(clientFd.at(i), &processed, sizeof(int));
+                int value;
+                int res = read(clientFd.at(i), &value, sizeof(int));
+                processed = value;
                 if (res < sizeof(int)) {
                     fprintf(stderr, "read[%zu] error %d", i, res);
                     processed = -1;
                 }
                 // Then errors
-                read(clientFd.at(i), &errors, sizeof(int));
+                read(clientFd.at(i), &value, sizeof(int));
+                errors = value;
+                // And the MiB the memory burn moved
+                read(clientFd.at(i), &value, sizeof(int));
+                memBytes = value * 1048576.0;
+                // The MB/s of the PCIe copies
+                read(clientFd.at(i), &value, sizeof(int));
+                clientPcieUp.at(i) = value / 1000.0f;
+                read(clientFd.at(i), &value, sizeof(int));
+                clientPcieDown.at(i) = value / 1000.0f;
+                // Then the mismatches the compares logged
+                read(clientFd.at(i), &value, sizeof(int));
+                if (value > 0 && value <= FAULT_LOG_SIZE) {
+                    FaultRecord faults[FAULT_LOG_SIZE];
+                    res = read(clientFd.at(i), faults,
+                               sizeof(FaultRecord) * value);
+                    if (res > 0)
+                        keepFaults(clientFaults.at(i), faults,
+                                   res / sizeof(FaultRecord));
+                }
+            } else
+                continue;
 
-                clientErrors.at(i) += errors;
-                if (processed == -1)
-                    clientCalcs.at(i) = -1;
-                else {
-                    double flops = (double)processed * (double)OPS_PER_MUL;
-                    struct timespec clientPrevTime = clientUpdateTime.at(i);
-                    double clientTimeDelta =
-                        (double)thisTimeSpec.tv_sec +
-                        (double)thisTimeSpec.tv_nsec / 1000000000.0 -
-                        ((double)clientPrevTime.tv_sec +
-                         (double)clientPrevTime.tv_nsec / 1000000000.0);
-                    clientUpdateTime.at(i) = thisTimeSpec;
-
-                    clientGflops.at(i) =
-                        (double)((unsigned long long int)processed *
-                                 OPS_PER_MUL) /
-                        clientTimeDelta / 1000.0 / 1000.0 / 1000.0;
-                    clientCalcs.at(i) += processed;
+            clientErrors.at(i) += errors;
+            if (processed == -1)
+                clientCalcs.at(i) = -1;
+            else {
+                double clientTimeDelta =
+                    toSeconds(thisTimeSpec) -
+                    toSeconds(clientUpdateTime.at(i));
+                clientUpdateTime.at(i) = thisTimeSpec;
+
+                clientGflops.at(i) = (double)processed * opsPerMul /
+                                     clientTimeDelta / 1000.0 / 1000.0 /
+                                     1000.0;
+                clientGbps.at(i) = memBytes / clientTimeDelta / 1e9;
+                // The first report also covers the init, leave it out
+                // of the statistics
+                if (clientCalcs.at(i)) {
+                    clientSamples.at(i).push_back(clientGflops.at(i));
+                    clientPcieUpSum.at(i) += clientPcieUp.at(i);
+                    clientPcieDownSum.at(i) += clientPcieDown.at(i);
+                    const GpuSample &s = clientSensors.at(i);
+                    if (s.valid) {
+                        clientPowerSum.at(i) += s.power / 1000.0;
+                        clientClockSum.at(i) += s.smClock;
+                        if (s.smClock)
+                            clientPerMhzSum.at(i) +=
+                                clientGflops.at(i) / s.smClock;
+                        if (s.throttle & THROTTLE_LIMITS)
+                            ++clientThrottled.at(i);
+                        clientThrottleSeen.at(i) |= s.throttle;
+                        ++clientSensorReports.at(i);
+                    }
+                    clientThroughput.at(i) += config.memOnly
+                                                  ? clientGbps.at(i)
+                                                  : clientGflops.at(i);
+                    if (config.untilStable > 0.0 &&
+                        !clientSteady.at(i).reached) {
+                        double t =
+                            toSeconds(thisTimeSpec) - toSeconds(startTimeSpec);
+                        StabilityWindow &w = clientWindow.at(i);
+                        w.add(t, config.memOnly ? clientGbps.at(i)
+                                                : clientGflops.at(i),
+                              clientTemp.at(i));
+                        if (w.steady(config.untilStable / 100.0)) {
+                            SteadyState &s = clientSteady.at(i);
+                            s.reached = true;
+                            s.after = t;
+                            s.value = w.mean();
+                            s.ci95 = w.ci95();
+                            s.temp = w.temp();
+                        }
+                    }
                 }
+                clientCalcs.at(i) += processed;
+                clientTotalErrors.at(i) += errors;
+
+                if (errors && clientFirstError.at(i) < 0.0) {
+                    clientFirstError.at(i) =
+                        toSeconds(thisTimeSpec) - toSeconds(startTimeSpec);
+                    if (config.failFast != FAIL_FAST_OFF) {
+                        // Its report is in, it gets no more
+                        clientStopped.at(i) = true;
+                        if (slots)
+                            slots[i].stop = true;
+                        else
+                            kill(clientPid.at(i), SIGTERM);
+                    }
+                }
+            }
+
+            // The ECC errors and XIDs of this interval.  The ECC counts
+            // start at the first sample, not to blame the burn for the
+            // errors of an earlier one.
+            const GpuSample &sample = clientSensors.at(i);
+            GpuSample &last = clientLastSensors.at(i);
+            unsigned long long corrected = 0, uncorrected = 0;
+            if (sample.ecc && last.ecc) {
+                corrected = sample.eccCorrected - last.eccCorrected;
+                uncorrected = sample.eccUncorrected - last.eccUncorrected;
+            }
+            unsigned xids = sample.xids - last.xids;
+            bool flagged = corrected || uncorrected || xids;
+            if (sample.valid)
+                last = sample;
+            clientEccCorrected.at(i) += corrected;
+            clientEccUncorrected.at(i) += uncorrected;
+            clientXids.at(i) += xids;
+            if (xids)
+                clientLastXid.at(i) = sample.xid;
+            if (flagged)
+                ++clientFlagged.at(i);
+
+            if (json) {
+                // A temperature of 0 means we haven't got one (yet)
+                char temp[16] = "null";
+                if (clientTemp.at(i))
+                    snprintf(temp, sizeof(temp), "%d", clientTemp.at(i));
+                fprintf(json,
+                        "{\"ts\":%.3f,\"gpu\":%zu,\"iters\":%lld,"
+                        "\"gflops\":%.1f,\"errors\":%lld,\"temp\":%s,"
+                        "\"alive\":%s",
+                        toSeconds(thisTimeSpec), i, clientCalcs.at(i),
+                        clientGflops.at(i), clientTotalErrors.at(i), temp,
+                        clientCalcs.at(i) == -1 ? "false" : "true");
+                if (config.memPattern != MEM_NONE)
+                    fprintf(json, ",\"gbps\":%.1f", clientGbps.at(i));
+                if (config.pcie)
+                    fprintf(json, ",\"h2d_gbps\":%.2f,\"d2h_gbps\":%.2f",
+                            clientPcieUp.at(i), clientPcieDown.at(i));
+                if (sample.valid) {
+                    fprintf(json,
+                            ",\"power_w\":%.1f,\"sm_mhz\":%u,"
+                            "\"mem_mhz\":%u,\"throttle\":%llu",
+                            sample.power / 1000.0, sample.smClock,
+                            sample.memClock, sample.throttle);
+                    if (sample.smClock && !config.memOnly)
+                        fprintf(json, ",\"gflops_per_mhz\":%.3f",
+                                clientGflops.at(i) / sample.smClock);
+                    if (sample.ecc)
+                        fprintf(json, ",\"ecc_sbe\":%llu,\"ecc_dbe\":%llu",
+                                corrected, uncorrected);
+                    fprintf(json, ",\"xid\":%u", xids);
+                    if (xids)
+                        fprintf(json, ",\"xid_code\":%u", sample.xid);
+                    fprintf(json, ",\"flagged\":%s",
+                            flagged ? "true" : "false");
+                }
+                fprintf(json, "}\n");
+            }
+            if (config.agentFd != -1) {
+                const GpuSample &s = clientSensors.at(i);
+                agentSend(config.agentFd, "r %zu %lld %.1f %lld %d %.1f\n",
+                          i, clientCalcs.at(i), clientGflops.at(i),
+                          clientTotalErrors.at(i), clientTemp.at(i),
+                          s.valid ? s.power / 1000.0 : -1.0);
+            }
+
+            childReport = true;
+        }
+
+        if (tempHandle != -1 && FD_ISSET(tempHandle, &waitHandles))
+            updateTemps(tempHandle, &clientTemp);
+
+        // Scrapes are served from this, until the next report
+        if (config.metrics && childReport) {
+            const double unknown = NAN;
+            std::vector<double> iters(clients), gflops(clients),
+                gbps(clients), errors(clients), alive(clients),
+                temp(clients), power(clients), smClock(clients),
+                memClock(clients), throttle(clients), eccCorrected(clients),
+                eccUncorrected(clients), xids(clients);
+            for (size_t i = 0; i < clients; ++i) {
+                const GpuSample &s = clientSensors.at(i);
+                alive.at(i) = clientCalcs.at(i) != -1 && !clientStopped.at(i);
+                iters.at(i) = clientCalcs.at(i) == -1 ? unknown
+                                                      : clientCalcs.at(i);
+                gflops.at(i) = clientGflops.at(i);
+                gbps.at(i) = clientGbps.at(i);
+                errors.at(i) = clientTotalErrors.at(i);
+                temp.at(i) = clientTemp.at(i) ? clientTemp.at(i) : unknown;
+                power.at(i) = s.valid ? s.power / 1000.0 : unknown;
+                smClock.at(i) = s.valid ? s.smClock : unknown;
+                memClock.at(i) = s.valid ? s.memClock : unknown;
+                throttle.at(i) = s.valid ? s.throttle : unknown;
+                eccCorrected.at(i) = clientEccCorrected.at(i);
+                eccUncorrected.at(i) = clientEccUncorrected.at(i);
+                xids.at(i) = clientXids.at(i);
+            }
+            std::string text;
+            addMetric(text, "gpu_burn_iterations_total", "counter",
+                      "GEMMs (or memory passes) done", iters);
+            addMetric(text, "gpu_burn_gflops", "gauge",
+                      "Gflop/s of the last report", gflops);
+            if (config.memPattern != MEM_NONE)
+                addMetric(text, "gpu_burn_memory_gbps", "gauge",
+                          "GB/s of the memory burn", gbps);
+            addMetric(text, "gpu_burn_errors_total", "counter",
+                      "Mismatches the compares found", errors);
+            addMetric(text, "gpu_burn_alive", "gauge",
+                      "1 while the GPU is burning", alive);
+            addMetric(text, "gpu_burn_temperature_celsius", "gauge",
+                      "GPU temperature", temp);
+            addMetric(text, "gpu_burn_power_watts", "gauge", "Board power",
+                      power);
+            addMetric(text, "gpu_burn_sm_clock_mhz", "gauge", "SM clock",
+                      smClock);
+            addMetric(text, "gpu_burn_memory_clock_mhz", "gauge",
+                      "Memory clock", memClock);
+            addMetric(text, "gpu_burn_throttle_reasons", "gauge",
+                      "NVML clock throttle reason bits", throttle);
+            if (nvml) {
+                addMetric(text, "gpu_burn_ecc_corrected_total", "counter",
+                          "Corrected ECC errors during the burn",
+                          eccCorrected);
+                addMetric(text, "gpu_burn_ecc_uncorrected_total", "counter",
+                          "Uncorrected ECC errors during the burn",
+                          eccUncorrected);
+                addMetric(text, "gpu_burn_xid_total", "counter",
+                          "Critical XID events during the burn", xids);
+            }
+            config.metrics->publish(text);
+        }
+
+        // Resetting the listeners
+        FD_ZERO(&waitHandles);
+        if (tempHandle != -1)
+            FD_SET(tempHandle, &waitHandles);
+        for (size_t i = 0; i < clientFd.size(); ++i)
+            if (!clientStopped.at(i))
+                FD_SET(clientFd.at(i), &waitHandles);
+
+        // Printing progress (if a child has initted already)
+        if (childReport) {
+            // A --daemon has no end to count to, it summarizes every
+            // DAEMON_SUMMARY_S instead of every 10% of the run, and only
+            // prints the progress with the summaries
+            float elapsed =
+                config.metrics
+                    ? (float)(thisTime - startTime) / DAEMON_SUMMARY_S * 10.0f
+                    : fminf((float)(thisTime - startTime) / (float)runTime *
+                                100.0f,
+                            100.0f);
+            bool summary = nextReport < elapsed;
+
+            for (size_t i = 0; i < clientErrors.size(); ++i)
+                if (clientErrors.at(i))
+                    clientFaulty.at(i) = true;
+
+            // As bare lines, to be read in a log
+            if (!config.metrics || summary) {
+                if (config.metrics)
+                    printf("%.1f h  ", (thisTime - startTime) / 3600.0);
+                else
+                    printf("\r%.1f%%  ", elapsed);
+                printf("proc'd: ");
+                for (size_t i = 0; i < clientCalcs.size(); ++i) {
+                    printf("%lld (", clientCalcs.at(i));
+                    if (!config.memOnly)
+                        printf("%.0f Gflop/s", clientGflops.at(i));
+                    if (config.memPattern != MEM_NONE)
+                        printf("%s%.0f GB/s", config.memOnly ? "" : ", ",
+                               clientGbps.at(i));
+                    if (config.pcie)
+                        printf(", PCIe %.1f/%.1f GB/s", clientPcieUp.at(i),
+                               clientPcieDown.at(i));
+                    printf(") ");
+                    if (i != clientCalcs.size() - 1)
+                        printf("- ");
+                }
+                printf("  errors: ");
+                for (size_t i = 0; i < clientErrors.size(); ++i) {
+                    std::string note = "%lld ";
+                    if (clientCalcs.at(i) == -1)
+                        note += " (DIED!)";
+                    else if (clientStopped.at(i))
+                        note += " (STOPPED)";
+                    else if (clientErrors.at(i))
+                        note += " (WARNING!)";
+                    if (clientEccUncorrected.at(i) || clientXids.at(i))
+                        note += " (ECC/XID!)";
+
+                    printf(note.c_str(), clientErrors.at(i));
+                    if (i != clientCalcs.size() - 1)
+                        printf("- ");
+                }
+                printf("  temps: ");
+                for (size_t i = 0; i < clientTemp.size(); ++i) {
+                    printf(clientTemp.at(i) != 0 ? "%d C " : "-- ",
+                           clientTemp.at(i));
+                    if (i != clientCalcs.size() - 1)
+                        printf("- ");
+                }
+
+                fflush(stdout);
+            }
+
+            if (summary) {
+                nextReport = elapsed + 10.0f;
+                char date[64];
+                time_t now = thisTimeSpec.tv_sec;
+                strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Z %Y",
+                         localtime(&now));
+                printf("\n\tSummary at:   %s\n\n", date);
+                if (config.p2pGroup) {
+                    reportLinks(config.p2pGroup, json,
+                                toSeconds(thisTimeSpec), false);
+                    printf("\n");
+                }
+                fflush(stdout);
+                if (json)
+                    fflush(json);
+                for (size_t i = 0; i < clientErrors.size(); ++i)
+                    clientErrors.at(i) = 0;
+            }
+        }
+
+        // Checking whether all clients are dead
+        bool oneAlive = false;
+        for (size_t i = 0; i < clientCalcs.size(); ++i)
+            if (clientCalcs.at(i) != -1)
+                oneAlive = true;
+        if (!oneAlive) {
+            fprintf(stderr, "\n\nNo clients are alive!  Aborting\n");
+            exit(ENOMEDIUM);
+        }
+
+        if (!config.metrics && startTime + runTime < thisTime)
+            break;
+
+        if (config.untilStable > 0.0) {
+            bool allSteady = true;
+            for (size_t i = 0; i < clients; ++i)
+                if (!clientSteady.at(i).reached && !clientStopped.at(i) &&
+                    clientCalcs.at(i) != -1)
+                    allSteady = false;
+            if (allSteady) {
+                printf("\n\nAll GPUs are steady, stopping\n");
+                break;
+            }
+        }
+
+        // Done screening when any GPU failed, or when all of them did
+        size_t stopped =
+            std::count(clientStopped.begin(), clientStopped.end(), true);
+        if ((config.failFast == FAIL_FAST_ALL && stopped) ||
+            (stopped && stopped == clients)) {
+            printf("\n\n%s failed, stopping\n",
+                   stopped == clients ? "All GPUs" : "A GPU");
+            break;
+        }
+    }
+
+    if (slots)
+        stopThreads(slots, clients, sigterm_timeout_threshold_secs);
+    else {
+        printf("\nKilling processes with SIGTERM (soft kill)\n");
+        fflush(stdout);
+        for (size_t i = 0; i < clientPid.size(); ++i)
+            kill(clientPid.at(i), SIGTERM);
+    }
+
+    if (tempPid)
+        kill(tempPid, SIGTERM);
+    sampler.stop();
+
+    // processes should be terminated by SIGTERM within threshold time (so wait and then check pids)
+    if (!slots)
+        waitChildren(clientPid, sigterm_timeout_threshold_secs);
+
+    // check each process and see if they are alive
+    std::vector<int> killed_processes; // track the number of killed processes
+    // loop through pids for each client / GPU
+    for (size_t i = 0; i < clientPid.size(); ++i) {
+        int status;
+        pid_t return_pid = waitpid(clientPid.at(i), &status, WNOHANG);
+        if (return_pid == clientPid.at(i)) {
+            /* child is finished. exit status in status */
+            killed_processes.push_back(return_pid);
+        }
+    }
+    // handle the tempPid
+    if (tempPid) {
+        int status;
+        pid_t return_pid = waitpid(tempPid, &status, WNOHANG);
+        if (return_pid == tempPid) {
+            /* child is finished. exit status in status */
+            killed_processes.push_back(return_pid);
+        }
+    }
+
+    // number of killed process should be number GPUs + 1 (need to add tempPid process) to exit while loop early
+    if (killed_processes.size() != clientPid.size() + (tempPid ? 1 : 0)) {
+        printf("\nKilling processes with SIGKILL (force kill)\n");
+
+        for (size_t i = 0; i < clientPid.size(); ++i) {
+            // check if pid was already killed with SIGTERM before using SIGKILL
+            if (std::find(killed_processes.begin(), killed_processes.end(), clientPid.at(i)) == killed_processes.end())
+                kill(clientPid.at(i), SIGKILL);
+        }
+
+        // check if pid was already killed with SIGTERM before using SIGKILL
+        if (tempPid && std::find(killed_processes.begin(), killed_processes.end(), tempPid) == killed_processes.end())
+            kill(tempPid, SIGKILL);
+    }
+
+    if (tempHandle != -1)
+        close(tempHandle);
+
+    while (wait(NULL) != -1)
+        ;
+    printf("done\n");
+
+    // The steady state if we've got one, else the mean of the reports.
+    // Faulty GPUs don't count.
+    std::vector<bool> clientSlow(clients);
+    if (config.baseline) {
+        std::vector<double> values(clients, -1.0);
+        for (size_t i = 0; i < clients; ++i) {
+            if (clientFirstError.at(i) >= 0.0 || clientCalcs.at(i) == -1 ||
+                clientSamples.at(i).empty())
+                continue;
+            values.at(i) = clientSteady.at(i).reached
+                               ? clientSteady.at(i).value
+                               : clientThroughput.at(i) /
+                                     clientSamples.at(i).size();
+        }
+        clientSlow = checkBaseline(config, devices, values, unit, json);
+    }
+
+    int status = 0;
+    printf("\nTested %d GPUs:\n", (int)clients);
+    for (size_t i = 0; i < clients; ++i) {
+        // What NVML saw, to tell why.  It doesn't change the result.
+        std::string why = eventNote(
+            clientEccCorrected.at(i), clientEccUncorrected.at(i),
+            clientXids.at(i), clientLastXid.at(i));
+        size_t n = clientSensorReports.at(i);
+        if (n && clientThrottled.at(i)) {
+            char throttled[192];
+            snprintf(throttled, sizeof(throttled),
+                     "%sthrottled in %.0f%% of reports by %s",
+                     why.empty() ? "" : ", ",
+                     clientThrottled.at(i) * 100.0 / n,
+                     throttleNames(clientThrottleSeen.at(i) & THROTTLE_LIMITS)
+                         .c_str());
+            why += throttled;
+        }
+        if (!why.empty())
+            why = " (" + why + ")";
+        // A GPU stopped at its first error may not have made it to a
+        // report line, which is where clientFaulty is set
+        if (clientFirstError.at(i) >= 0.0) {
+            clientFaulty.at(i) = true;
+            printf("\tGPU %d: FAULTY (first error after %.1f s)%s\n", (int)i,
+                   clientFirstError.at(i), why.c_str());
+        } else
+            printf("\tGPU %d: %s%s\n", (int)i,
+                   clientFaulty.at(i)  ? "FAULTY"
+                   : clientSlow.at(i) ? "SLOW"
+                                      : "OK",
+                   why.c_str());
+        if (clientFaulty.at(i) || clientSlow.at(i))
+            status |= 1 << std::min(devices.at(i), 7);
+    }
+
+    printf("\nGflop/s     min      mean        p1\n");
+    for (size_t i = 0; i < clients; ++i) {
+        std::vector<float> &samples = clientSamples.at(i);
+        double sum = 0.0;
+        for (size_t s = 0; s < samples.size(); ++s)
+            sum += samples.at(s);
+        float mean = samples.empty() ? 0.0f : sum / samples.size();
+        // The rate the slowest 1% of the reports fall under
+        float p1 = percentile(samples, 1.0);
+        float min = samples.empty() ? 0.0f : samples.front();
+        char firstError[32] = "null";
+        if (clientFirstError.at(i) >= 0.0)
+            snprintf(firstError, sizeof(firstError), "%.3f",
+                     clientFirstError.at(i));
+        printf("\tGPU %d: %9.0f %9.0f %9.0f\n", (int)i, min, mean, p1);
+        if (config.agentFd != -1)
+            agentSend(config.agentFd, "d %zu %s %.1f %lld %s\n", i,
+                      clientFaulty.at(i)  ? "FAULTY"
+                      : clientSlow.at(i) ? "SLOW"
+                                         : "OK",
+                      mean, clientTotalErrors.at(i),
+                      config.migInstances.empty()
+                          ? deviceModel(devices.at(i)).c_str()
+                          : config.migInstances.at(i).model.c_str());
+
+        if (json)
+            fprintf(json,
+                    "{\"summary\":true,\"gpu\":%zu,\"samples\":%zu,"
+                    "\"iters\":%lld,\"errors\":%lld,\"faulty\":%s,"
+                    "\"gflops_min\":%.1f,\"gflops_mean\":%.1f,"
+                    "\"gflops_p1\":%.1f,\"first_error_s\":%s",
+                    i, samples.size(), clientCalcs.at(i),
+                    clientTotalErrors.at(i),
+                    clientFaulty.at(i) ? "true" : "false", min, mean, p1,
+                    firstError);
+        if (json && nvml)
+            fprintf(json,
+                    ",\"ecc_sbe\":%llu,\"ecc_dbe\":%llu,\"xids\":%u,"
+                    "\"flagged_reports\":%zu,\"throttled_reports\":%zu,"
+                    "\"throttle_seen\":%llu",
+                    clientEccCorrected.at(i), clientEccUncorrected.at(i),
+                    clientXids.at(i), clientFlagged.at(i),
+                    clientThrottled.at(i), clientThrottleSeen.at(i));
+        if (json)
+            fprintf(json, "}\n");
+    }
+
+    if (config.untilStable > 0.0) {
+        printf("\nSteady state (%s within %.1f%% over %d s, 95%% CI):\n", unit,
+               config.untilStable, config.stableWindow);
+        for (size_t i = 0; i < clients; ++i) {
+            const SteadyState &s = clientSteady.at(i);
+            if (s.reached)
+                printf("\tGPU %d: %9.1f +- %.1f %s after %.0f s, %d C\n",
+                       (int)i, s.value, s.ci95, unit, s.after, s.temp);
+            else
+                printf("\tGPU %d: not reached\n", (int)i);
+            if (json && s.reached)
+                fprintf(json,
+                        "{\"steady\":true,\"gpu\":%zu,\"unit\":\"%s\","
+                        "\"value\":%.1f,\"ci95\":%.1f,\"after_s\":%.1f,"
+                        "\"temp\":%d}\n",
+                        i, unit, s.value, s.ci95, s.after, s.temp);
+            else if (json)
+                fprintf(json, "{\"steady\":false,\"gpu\":%zu}\n", i);
+        }
+    }
+
+    if (nvml && !config.memOnly) {
+        printf("\nPower and clocks (%s engine):\n",
+               g_engineNames[config.engine]);
+        for (size_t i = 0; i < clients; ++i) {
+            size_t n = clientSensorReports.at(i);
+            if (!n) {
+                printf("\tGPU %d: --\n", (int)i);
+                continue;
+            }
+            double watts = clientPowerSum.at(i) / n;
+            double mhz = clientClockSum.at(i) / n;
+            // Of the same reports
+            std::vector<float> &samples = clientSamples.at(i);
+            double gflops = 0.0;
+            for (size_t s = 0; s < samples.size(); ++s)
+                gflops += samples.at(s);
+            gflops = samples.empty() ? 0.0 : gflops / samples.size();
+            // Per MHz of each report, so a GPU that's only slow for being
+            // throttled scores as the others
+            double perMhz = clientPerMhzSum.at(i) / n;
+            printf("\tGPU %d: %6.0f W %6.0f MHz %8.1f Gflop/s per W %8.3f "
+                   "Gflop/s per MHz, throttled in %.0f%% of reports\n",
+                   (int)i, watts, mhz, watts > 0.0 ? gflops / watts : 0.0,
+                   perMhz, clientThrottled.at(i) * 100.0 / n);
+            if (json)
+                fprintf(json,
+                        "{\"engine\":\"%s\",\"gpu\":%zu,\"power_w\":%.1f,"
+                        "\"sm_mhz\":%.0f,\"gflops_per_w\":%.2f,"
+                        "\"gflops_per_mhz\":%.3f,\"throttled_pct\":%.1f}\n",
+                        g_engineNames[config.engine], i, watts, mhz,
+                        watts > 0.0 ? gflops / watts : 0.0, perMhz,
+                        clientThrottled.at(i) * 100.0 / n);
+        }
+    }
+
+    if (config.pcie) {
+        printf("\nPCIe GB/s  host to device  device to host\n");
+        for (size_t i = 0; i < clients; ++i) {
+            size_t n = clientSamples.at(i).size();
+            double up = n ? clientPcieUpSum.at(i) / n : 0.0;
+            double down = n ? clientPcieDownSum.at(i) / n : 0.0;
+            printf("\tGPU %d: %14.2f %15.2f\n", (int)i, up, down);
+            if (json)
+                fprintf(json,
+                        "{\"pcie\":true,\"gpu\":%zu,\"h2d_gbps\":%.2f,"
+                        "\"d2h_gbps\":%.2f}\n",
+                        i, up, down);
+        }
+    }
+
+    if (config.profile.shape != PROFILE_FLAT && nvml) {
+        const LoadProfile &profile = config.profile;
+        printf("\nPower per phase of the %s profile (W):\n",
+               g_profileNames[profile.shape]);
+        for (size_t i = 0; i < clients; ++i) {
+            printf("\tGPU %d:", (int)i);
+            for (int p = 0; p < profile.phases(); ++p) {
+                double watts = sampler.phasePower(i, p);
+                printf(watts < 0.0 ? " %s --" : " %s %.0f",
+                       profile.phaseName(p).c_str(), watts);
+                if (json && watts >= 0.0)
+                    fprintf(json,
+                            "{\"profile\":\"%s\",\"gpu\":%zu,"
+                            "\"phase\":\"%s\",\"power_w\":%.1f}\n",
+                            g_profileNames[profile.shape], i,
+                            profile.phaseName(p).c_str(), watts);
+            }
+            printf("\n");
+        }
+    }
+
+    for (size_t i = 0; i < clients; ++i)
+        reportFaults(i, clientFaults.at(i), clientTotalErrors.at(i), config,
+                     json);
+
+    if (config.p2pGroup) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        printf("\nPeer-to-peer links:\n");
+        reportLinks(config.p2pGroup, json, toSeconds(now), true);
+    }
+
+    if (json)
+        fclose(json);
+    return status;
+}
+
+// Connects to the --coordinator at address (HOST:PORT), retrying while it
+// comes up, and waits for it to start us.  Returns the socket, with start
+// the wall clock time to start at.
+int joinCoordinator(const char *address, double &start) {
+    std::string host(address);
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos) {
+        fprintf(stderr, "--agent needs HOST:PORT\n");
+        exit(EINVAL);
+    }
+    std::string port = host.substr(colon + 1);
+    host.erase(colon);
+
+    int fd = -1;
+    for (int tries = 0; fd == -1 && tries < AGENT_CONNECT_S; ++tries) {
+        if (tries)
+            sleep(1);
+        fd = openSocket(host.c_str(), port.c_str());
+    }
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't connect to the coordinator at %s\n",
+                address);
+        exit(ECONNREFUSED);
+    }
+
+    char name[256] = "unknown";
+    gethostname(name, sizeof(name));
+    name[sizeof(name) - 1] = 0;
+    agentSend(fd, "hello %s\n", name);
+    printf("Joined the coordinator at %s, waiting for the start\n", address);
+    fflush(stdout);
+
+    std::string line;
+    if (!readLine(fd, line) || sscanf(line.c_str(), "start %lf", &start) != 1) {
+        fprintf(stderr, "The coordinator at %s didn't start us\n", address);
+        exit(ECONNABORTED);
+    }
+    return fd;
+}
+
+// What the --coordinator knows of a GPU of an agent
+struct ClusterGpu {
+    long long iters = 0;
+    long long errors = 0;
+    float gflops = 0.0f; // Of its last report
+    int temp = 0;
+    double power = -1.0; // W, -1 if the agent hasn't got NVML
+    std::string status;  // Once its agent is done, LOST if it never was
+    double mean = 0.0;   // Gflop/s
+    std::string model;
+};
+
+struct ClusterNode {
+    int fd;
+    std::string host;
+    std::string pending; // Of the line being read
+    double heard;        // When it last sent anything
+    std::vector<ClusterGpu> gpus;
+};
 
-                childReport = true;
-            }
+// Takes in a line an agent sent
+void clusterLine(ClusterNode &node, const std::string &line) {
+    unsigned gpu;
+    ClusterGpu g;
+    char status[16];
+    int end = 0;
+    if (sscanf(line.c_str(), "r %u %lld %f %lld %d %lf", &gpu, &g.iters,
+               &g.gflops, &g.errors, &g.temp, &g.power) == 6 &&
+        gpu < 1024) {
+        if (node.gpus.size() <= gpu)
+            node.gpus.resize(gpu + 1);
+        ClusterGpu &known = node.gpus.at(gpu);
+        known.iters = g.iters;
+        known.gflops = g.gflops;
+        known.errors = g.errors;
+        known.temp = g.temp;
+        known.power = g.power;
+    } else if (sscanf(line.c_str(), "d %u %15s %lf %lld %n", &gpu, status,
+                      &g.mean, &g.errors, &end) == 4 &&
+               end && gpu < 1024) {
+        if (node.gpus.size() <= gpu)
+            node.gpus.resize(gpu + 1);
+        ClusterGpu &known = node.gpus.at(gpu);
+        known.status = status;
+        known.mean = g.mean;
+        known.errors = g.errors;
+        known.model = line.substr(end);
+    }
+}
 
-        if (FD_ISSET(tempHandle, &waitHandles))
-            updateTemps(tempHandle, &clientTemp);
+// --coordinator: waits for --nodes agents, starts them together and
+// collects their reports into a table of the whole cluster, where a GPU is
+// also SLOW below --slow-frac of the median of its model.  Returns 1 if
+// any GPU wasn't OK or any agent was lost.
+int coordinate(const BurnConfig &config) {
+    char port[16];
+    snprintf(port, sizeof(port), "%d", config.coordinatorPort);
+    int listenFd = openSocket(NULL, port);
+    if (listenFd == -1) {
+        fprintf(stderr, "Couldn't listen on port %s\n", port);
+        exit(EADDRINUSE);
+    }
 
-        // Resetting the listeners
+    std::vector<ClusterNode> nodes;
+    printf("Waiting for %d agents on port %s\n", config.clusterNodes, port);
+    fflush(stdout);
+    double joinDeadline = getTime() + COORDINATOR_JOIN_S;
+    while ((int)nodes.size() < config.clusterNodes &&
+           getTime() < joinDeadline) {
+        fd_set waitHandles;
         FD_ZERO(&waitHandles);
-        FD_SET(tempHandle, &waitHandles);
-        for (size_t i = 0; i < clientFd.size(); ++i)
-            FD_SET(clientFd.at(i), &waitHandles);
+        FD_SET(listenFd, &waitHandles);
+        struct timeval wait = {1, 0};
+        if (select(listenFd + 1, &waitHandles, NULL, NULL, &wait) <= 0)
+            continue;
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd == -1)
+            continue;
+        // Whatever connects has a moment to say who it is
+        struct timeval helloTimeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &helloTimeout,
+                   sizeof(helloTimeout));
+        std::string line;
+        if (!readLine(fd, line) || line.compare(0, 6, "hello ")) {
+            close(fd);
+            continue;
+        }
+        ClusterNode node;
+        node.fd = fd;
+        node.host = line.substr(6);
+        nodes.push_back(node);
+        printf("\t%s joined (%zu/%d)\n", node.host.c_str(), nodes.size(),
+               config.clusterNodes);
+        fflush(stdout);
+    }
+    close(listenFd);
+    if (nodes.empty()) {
+        fprintf(stderr, "No agents joined\n");
+        exit(ENOMEDIUM);
+    }
+    if ((int)nodes.size() < config.clusterNodes)
+        printf("Only %zu of %d agents joined, starting them\n", nodes.size(),
+               config.clusterNodes);
 
-        // Printing progress (if a child has initted already)
-        if (childReport) {
-            float elapsed =
-                fminf((float)(thisTime - startTime) / (float)runTime * 100.0f,
-                      100.0f);
-            printf("\r%.1f%%  ", elapsed);
-            printf("proc'd: ");
-            for (size_t i = 0; i < clientCalcs.size(); ++i) {
-                printf("%d (%.0f Gflop/s) ", clientCalcs.at(i),
-                       clientGflops.at(i));
-                if (i != clientCalcs.size() - 1)
-                    printf("- ");
-            }
-            printf("  errors: ");
-            for (size_t i = 0; i < clientErrors.size(); ++i) {
-                std::string note = "%d ";
-                if (clientCalcs.at(i) == -1)
-                    note += " (DIED!)";
-                else if (clientErrors.at(i))
-                    note += " (WARNING!)";
+    double start = getTime() + COORDINATOR_LEAD_S;
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        struct timeval noTimeout = {0, 0};
+        setsockopt(nodes.at(n).fd, SOL_SOCKET, SO_RCVTIMEO, &noTimeout,
+                   sizeof(noTimeout));
+        agentSend(nodes.at(n).fd, "start %.3f\n", start);
+        nodes.at(n).heard = start;
+    }
+    printf("Starting %zu agents in %d s\n", nodes.size(), COORDINATOR_LEAD_S);
 
-                printf(note.c_str(), clientErrors.at(i));
-                if (i != clientCalcs.size() - 1)
-                    printf("- ");
-            }
-            printf("  temps: ");
-            for (size_t i = 0; i < clientTemp.size(); ++i) {
-                printf(clientTemp.at(i) != 0 ? "%d C " : "-- ",
-                       clientTemp.at(i));
-                if (i != clientCalcs.size() - 1)
-                    printf("- ");
+    size_t open = nodes.size();
+    while (open) {
+        fd_set waitHandles;
+        FD_ZERO(&waitHandles);
+        int maxHandle = -1;
+        for (size_t n = 0; n < nodes.size(); ++n)
+            if (nodes.at(n).fd != -1) {
+                FD_SET(nodes.at(n).fd, &waitHandles);
+                maxHandle = std::max(maxHandle, nodes.at(n).fd);
             }
+        struct timeval wait = {1, 0};
+        select(maxHandle + 1, &waitHandles, NULL, NULL, &wait);
+        double now = getTime();
 
-            fflush(stdout);
-
-            for (size_t i = 0; i < clientErrors.size(); ++i)
-                if (clientErrors.at(i))
-                    clientFaulty.at(i) = true;
-
-            if (nextReport < elapsed) {
-                nextReport = elapsed + 10.0f;
-                printf("\n\tSummary at:   ");
-                fflush(stdout);
-                system("date"); // Printing a date
-                fflush(stdout);
-                printf("\n");
-                for (size_t i = 0; i < clientErrors.size(); ++i)
-                    clientErrors.at(i) = 0;
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            ClusterNode &node = nodes.at(n);
+            if (node.fd == -1)
+                continue;
+            if (!FD_ISSET(node.fd, &waitHandles)) {
+                if (now - node.heard > COORDINATOR_SILENT_S) {
+                    printf("\n%s went silent, leaving it out\n",
+                           node.host.c_str());
+                    close(node.fd);
+                    node.fd = -1;
+                    --open;
+                }
+                continue;
+            }
+            char buf[4096];
+            ssize_t len = read(node.fd, buf, sizeof(buf));
+            if (len <= 0) {
+                close(node.fd);
+                node.fd = -1;
+                --open;
+                continue;
+            }
+            node.heard = now;
+            node.pending.append(buf, len);
+            size_t eol;
+            while ((eol = node.pending.find('\n')) != std::string::npos) {
+                clusterLine(node, node.pending.substr(0, eol));
+                node.pending.erase(0, eol + 1);
             }
         }
 
-        // Checking whether all clients are dead
-        bool oneAlive = false;
-        for (size_t i = 0; i < clientCalcs.size(); ++i)
-            if (clientCalcs.at(i) != -1)
-                oneAlive = true;
-        if (!oneAlive) {
-            fprintf(stderr, "\n\nNo clients are alive!  Aborting\n");
-            exit(ENOMEDIUM);
-        }
-
-        if (startTime + runTime < thisTime)
-            break;
+        size_t gpus = 0;
+        long long errors = 0;
+        double gflops = 0.0, power = 0.0;
+        for (size_t n = 0; n < nodes.size(); ++n)
+            for (size_t i = 0; i < nodes.at(n).gpus.size(); ++i) {
+                const ClusterGpu &g = nodes.at(n).gpus.at(i);
+                ++gpus;
+                errors += g.errors;
+                gflops += g.gflops;
+                power += std::max(g.power, 0.0);
+            }
+        printf("\ragents: %zu/%zu  GPUs: %zu  Gflop/s: %.0f  power: %.0f W  "
+               "errors: %lld   ",
+               open, nodes.size(), gpus, gflops, power, errors);
+        fflush(stdout);
     }
 
-    printf("\nKilling processes with SIGTERM (soft kill)\n");
-    fflush(stdout);
-    for (size_t i = 0; i < clientPid.size(); ++i)
-        kill(clientPid.at(i), SIGTERM);
+    // The medians of the models, of the GPUs that came through
+    std::map<std::string, std::vector<float> > byModel;
+    for (size_t n = 0; n < nodes.size(); ++n)
+        for (size_t i = 0; i < nodes.at(n).gpus.size(); ++i) {
+            const ClusterGpu &g = nodes.at(n).gpus.at(i);
+            if ((g.status == "OK" || g.status == "SLOW") && g.mean > 0.0)
+                byModel[g.model].push_back(g.mean);
+        }
+    std::map<std::string, float> median;
+    for (std::map<std::string, std::vector<float> >::iterator it =
+             byModel.begin();
+         it != byModel.end(); ++it)
+        median[it->first] = percentile(it->second, 50.0);
 
-    kill(tempPid, SIGTERM);
+    FILE *json = openJson(config.jsonOut);
+    int status = (int)nodes.size() < config.clusterNodes;
+    size_t gpus = 0, bad = 0;
+    printf("\n\nCluster of %zu agents (slow below %.0f%% of the median of "
+           "the model):\n",
+           nodes.size(), config.slowFraction * 100.0);
+    printf("\t%-24s %4s %10s %8s %10s  %s\n", "node", "GPU", "Gflop/s",
+           "errors", "of median", "status");
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        ClusterNode &node = nodes.at(n);
+        if (node.gpus.empty()) {
+            printf("\t%-24s %4s %10s %8s %10s  LOST\n", node.host.c_str(),
+                   "--", "--", "--", "--");
+            status = 1;
+        }
+        for (size_t i = 0; i < node.gpus.size(); ++i) {
+            ClusterGpu &g = node.gpus.at(i);
+            if (g.status.empty())
+                g.status = "LOST";
+            bool peers = median.count(g.model);
+            double ofMedian = peers ? g.mean / median[g.model] : 0.0;
+            if (g.status == "OK" && peers && ofMedian < config.slowFraction)
+                g.status = "SLOW";
+            ++gpus;
+            if (g.status != "OK") {
+                ++bad;
+                status = 1;
+            }
+            printf("\t%-24s %4zu %10.0f %8lld %9.0f%%  %s\n",
+                   node.host.c_str(), i, g.mean, g.errors, ofMedian * 100.0,
+                   g.status.c_str());
+            if (json)
+                fprintf(json,
+                        "{\"cluster\":true,\"node\":\"%s\",\"gpu\":%zu,"
+                        "\"model\":\"%s\",\"gflops_mean\":%.1f,"
+                        "\"errors\":%lld,\"of_median\":%.3f,"
+                        "\"status\":\"%s\"}\n",
+                        node.host.c_str(), i, g.model.c_str(), g.mean,
+                        g.errors, ofMedian, g.status.c_str());
+        }
+    }
+    printf("\n%zu of %zu GPUs not OK\n", bad, gpus);
+    if (json)
+        fclose(json);
+    return status;
+}
 
-    // processes should be terminated by SIGTERM within threshold time (so wait and then check pids)
-    std::this_thread::sleep_for(sigterm_timeout_threshold_secs);
+// The MIG instances nvidia-smi -L lists, only those of GPU gpu unless -1
+std::vector<MigInstance> listMig(int gpu) {
+    std::vector<MigInstance> instances;
+    FILE *smi = popen("nvidia-smi -L", "r");
+    if (!smi)
+        return instances;
 
-    // check each process and see if they are alive
-    std::vector<int> killed_processes; // track the number of killed processes
-    // loop through pids for each client / GPU
-    for (size_t i = 0; i < clientPid.size(); ++i) {
-        int status;
-        pid_t return_pid = waitpid(clientPid.at(i), &status, WNOHANG);
-        if (return_pid == clientPid.at(i)) {
-            /* child is finished. exit status in status */
-            killed_processes.push_back(return_pid);
+    // GPU 0: NVIDIA A100-SXM4-40GB (UUID: GPU-...)
+    //   MIG 3g.20gb     Device  0: (UUID: MIG-...)
+    const std::regex gpuLine("^GPU (\\d+): (.*) \\(UUID: (GPU-[^)]+)\\)");
+    const std::regex migLine(
+        "^\\s+MIG (\\S+)\\s+Device\\s+\\d+: \\(UUID: (MIG-[^)]+)\\)");
+    MigInstance parent;
+    parent.gpu = -1;
+    std::string name;
+    char line[512];
+    while (fgets(line, sizeof(line), smi)) {
+        std::string l(line);
+        std::smatch match;
+        if (std::regex_search(l, match, gpuLine)) {
+            parent.gpu = atoi(match[1].str().c_str());
+            parent.gpuUuid = match[3];
+            name = match[2];
+        } else if (parent.gpu != -1 && (gpu == -1 || gpu == parent.gpu) &&
+                   std::regex_search(l, match, migLine)) {
+            MigInstance instance = parent;
+            instance.uuid = match[2];
+            instance.model = name + ", MIG " + match[1].str();
+            instances.push_back(instance);
         }
     }
-    // handle the tempPid
-    int status;
-    pid_t return_pid = waitpid(tempPid, &status, WNOHANG);
-    if (return_pid == tempPid) {
-        /* child is finished. exit status in status */
-        killed_processes.push_back(return_pid);
-    }
+    pclose(smi);
+    return instances;
+}
 
-    // number of killed process should be number GPUs + 1 (need to add tempPid process) to exit while loop early
-    if (killed_processes.size() != clientPid.size() + 1) {
-        printf("\nKilling processes with SIGKILL (force kill)\n");
+// Forks a process to count the devices, so that this one doesn't init CUDA
+int countDevices() {
+    int countPipe[2];
+    pipe(countPipe);
+    pid_t pid = fork();
+    if (!pid) {
+        close(countPipe[0]);
+        int devCount = initCuda();
+        write(countPipe[1], &devCount, sizeof(int));
+        exit(0);
+    }
+    close(countPipe[1]);
+    int devCount = 0;
+    read(countPipe[0], &devCount, sizeof(int));
+    close(countPipe[0]);
+    waitpid(pid, NULL, 0);
+    return devCount;
+}
 
-        for (size_t i = 0; i < clientPid.size(); ++i) {
-            // check if pid was already killed with SIGTERM before using SIGKILL
-            if (std::find(killed_processes.begin(), killed_processes.end(), clientPid.at(i)) == killed_processes.end())
-                kill(clientPid.at(i), SIGKILL);
+// --mig and --mps: forks --mps clients for each MIG instance or GPU.  A
+// MIG instance is the only device its clients see, and under MPS each
+// client gets its active thread percentage before it inits CUDA.
+template <class T>
+int launchShared(int runLength, const BurnConfig &config, int device_id,
+                 std::chrono::seconds sigterm_timeout_threshold_secs) {
+    BurnConfig clientConfig = config;
+    std::vector<MigInstance> instances;
+    std::vector<int> targets;
+    if (config.mig) {
+        instances = listMig(device_id);
+        if (instances.empty()) {
+            fprintf(stderr, "No MIG instances\n");
+            exit(ENODEV);
         }
-
-        // check if pid was already killed with SIGTERM before using SIGKILL
-        if (std::find(killed_processes.begin(), killed_processes.end(), tempPid) == killed_processes.end())
-            kill(tempPid, SIGKILL);
+        for (size_t i = 0; i < instances.size(); ++i)
+            targets.push_back(instances.at(i).gpu);
+    } else if (device_id > -1)
+        targets.push_back(device_id);
+    else {
+        int devCount = countDevices();
+        if (!devCount) {
+            fprintf(stderr, "No CUDA devices\n");
+            exit(ENODEV);
+        }
+        for (int i = 0; i < devCount; ++i)
+            targets.push_back(i);
     }
 
-    close(tempHandle);
+    std::vector<int> devices;
+    for (size_t t = 0; t < targets.size(); ++t)
+        for (int c = 0; c < config.mpsClients; ++c) {
+            devices.push_back(targets.at(t));
+            if (config.mig)
+                clientConfig.migInstances.push_back(instances.at(t));
+        }
+    for (size_t i = 0; i < devices.size(); ++i)
+        if (config.mig)
+            printf("Client %zu: %s (GPU %d, %s)\n", i,
+                   clientConfig.migInstances.at(i).uuid.c_str(),
+                   devices.at(i), clientConfig.migInstances.at(i).model.c_str());
+        else if (config.mpsClients > 1)
+            printf("Client %zu: GPU %d\n", i, devices.at(i));
 
-    while (wait(NULL) != -1)
-        ;
-    printf("done\n");
+    std::vector<int> clientPipes;
+    std::vector<pid_t> clientPids;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        int clientPipe[2];
+        pipe(clientPipe);
+        pid_t pid = fork();
+        if (!pid) {
+            // Child
+            close(clientPipe[0]);
+            if (config.mig)
+                setenv("CUDA_VISIBLE_DEVICES",
+                       clientConfig.migInstances.at(i).uuid.c_str(), 1);
+            if (config.mpsPercent) {
+                char percent[16];
+                snprintf(percent, sizeof(percent), "%d", config.mpsPercent);
+                setenv("CUDA_MPS_ACTIVE_THREAD_PERCENTAGE", percent, 1);
+            }
+            initCuda();
+            startBurn<T>(config.mig ? 0 : devices.at(i), clientPipe[1],
+                         clientConfig);
+            close(clientPipe[1]);
+            return 0;
+        }
+        clientPids.push_back(pid);
+        clientPipes.push_back(clientPipe[0]);
+        close(clientPipe[1]);
+    }
 
-    printf("\nTested %d GPUs:\n", (int)clientPid.size());
-    for (size_t i = 0; i < clientPid.size(); ++i)
-        printf("\tGPU %d: %s\n", (int)i, clientFaulty.at(i) ? "FAULTY" : "OK");
+    int status = listenClients(clientPipes, clientPids, runLength,
+                               sigterm_timeout_threshold_secs, clientConfig,
+                               devices);
+    for (size_t i = 0; i < clientPipes.size(); ++i)
+        close(clientPipes.at(i));
+    return status;
 }
 
+// Returns the status of listenClients() in the monitor, 0 in the workers
 template <class T>
-void launch(int runLength, bool useDoubles, bool useTensorCores,
-            ssize_t useBytes, int device_id, const char * kernelFile,
-            std::chrono::seconds sigterm_timeout_threshold_secs) {
+int launch(int runLength, const BurnConfig &config, int device_id,
+           std::chrono::seconds sigterm_timeout_threshold_secs) {
 #if IS_JETSON
     std::ifstream f_model("/proc/device-tree/model");
     std::stringstream ss_model;
@@ -676,15 +4418,58 @@ void launch(int runLength, bool useDoubles, bool useTensorCores,
     system("nvidia-smi -L");
 #endif
 
-    // Initting A and B with random data
-    T *A = (T *)malloc(sizeof(T) * SIZE * SIZE);
-    T *B = (T *)malloc(sizeof(T) * SIZE * SIZE);
-    srand(10);
-    for (size_t i = 0; i < SIZE * SIZE; ++i) {
-        A[i] = (T)((double)(rand() % 1000000) / 100000.0);
-        B[i] = (T)((double)(rand() % 1000000) / 100000.0);
+    // A and B are generated on each device from the seed (see initMatrix
+    // in compare.cu), so there's nothing to prepare on the host
+
+    if (config.threads) {
+        int devCount = initCuda();
+        if (!devCount) {
+            fprintf(stderr, "No CUDA devices\n");
+            exit(ENODEV);
+        }
+        std::vector<int> devices;
+        for (int i = 0; i < devCount; ++i)
+            if (device_id == -1 || device_id == i)
+                devices.push_back(i);
+
+        // The workers of the --p2p group wait for each other, so it's
+        // never freed in case one gets stuck
+        BurnConfig workerConfig = config;
+        workerConfig.stopTimeout = sigterm_timeout_threshold_secs;
+        if (config.p2p != P2P_NONE) {
+            if (devices.size() < 2)
+                printf("--p2p needs at least two GPUs, burning without it\n");
+            else
+                workerConfig.p2pGroup = new P2PGroup(config.p2p, devices);
+        }
+
+        WorkerSlot *slots = allocSlots(devices.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < devices.size(); ++i)
+            workers.push_back(std::thread(startBurn<T>, devices.at(i), -1,
+                                          std::cref(workerConfig), slots + i));
+
+        int status = listenClients(std::vector<int>(), std::vector<pid_t>(),
+                                   runLength, sigterm_timeout_threshold_secs,
+                                   workerConfig, devices, slots);
+
+        // Stuck workers are left behind, as their slots are
+        bool stuck = false;
+        for (size_t i = 0; i < workers.size(); ++i)
+            if (slots[i].state == WorkerSlot::RUNNING) {
+                workers.at(i).detach();
+                stuck = true;
+            } else
+                workers.at(i).join();
+        if (!stuck)
+            free(slots);
+        return status;
     }
 
+    if (config.mig || config.mpsClients > 1 || config.mpsPercent)
+        return launchShared<T>(runLength, config, device_id,
+                               sigterm_timeout_threshold_secs);
+
     // Forking a process..  This one checks the number of devices to use,
     // returns the value, and continues to use the first one.
     int mainPipe[2];
@@ -693,6 +4478,7 @@ void launch(int runLength, bool useDoubles, bool useTensorCores,
     std::vector<int> clientPipes;
     std::vector<pid_t> clientPids;
     clientPipes.push_back(readMain);
+    int status = 0;
 
     if (device_id > -1) {
         pid_t myPid = fork();
@@ -703,16 +4489,17 @@ void launch(int runLength, bool useDoubles, bool useTensorCores,
             initCuda();
             int devCount = 1;
             write(writeFd, &devCount, sizeof(int));
-            startBurn<T>(device_id, writeFd, A, B, useDoubles, useTensorCores,
-                         useBytes, kernelFile);
+            startBurn<T>(device_id, writeFd, config);
             close(writeFd);
-            return;
+            return 0;
         } else {
             clientPids.push_back(myPid);
             close(mainPipe[1]);
             int devCount;
             read(readMain, &devCount, sizeof(int));
-            listenClients(clientPipes, clientPids, runLength, sigterm_timeout_threshold_secs);
+            status = listenClients(clientPipes, clientPids, runLength,
+                                   sigterm_timeout_threshold_secs, config,
+                                   std::vector<int>(1, device_id));
         }
         for (size_t i = 0; i < clientPipes.size(); ++i)
             close(clientPipes.at(i));
@@ -725,11 +4512,10 @@ void launch(int runLength, bool useDoubles, bool useTensorCores,
             int devCount = initCuda();
             write(writeFd, &devCount, sizeof(int));
 
-            startBurn<T>(0, writeFd, A, B, useDoubles, useTensorCores,
-                         useBytes, kernelFile);
+            startBurn<T>(0, writeFd, config);
 
             close(writeFd);
-            return;
+            return 0;
         } else {
             clientPids.push_back(myPid);
 
@@ -752,26 +4538,28 @@ void launch(int runLength, bool useDoubles, bool useTensorCores,
                         // Child
                         close(slavePipe[0]);
                         initCuda();
-                        startBurn<T>(i, slavePipe[1], A, B, useDoubles,
-                                     useTensorCores, useBytes, kernelFile);
+                        startBurn<T>(i, slavePipe[1], config);
 
                         close(slavePipe[1]);
-                        return;
+                        return 0;
                     } else {
                         clientPids.push_back(slavePid);
                         close(slavePipe[1]);
                     }
                 }
 
-                listenClients(clientPipes, clientPids, runLength, sigterm_timeout_threshold_secs);
+                std::vector<int> devices;
+                for (int i = 0; i < devCount; ++i)
+                    devices.push_back(i);
+                status = listenClients(clientPipes, clientPids, runLength,
+                                       sigterm_timeout_threshold_secs, config,
+                                       devices);
             }
         }
         for (size_t i = 0; i < clientPipes.size(); ++i)
             close(clientPipes.at(i));
     }
-
-    free(A);
-    free(B);
+    return status;
 }
 
 void showHelp() {
@@ -784,8 +4572,76 @@ void showHelp() {
     printf("-tc\tTry to use Tensor cores\n");
     printf("-l\tLists all GPUs in the system\n");
     printf("-i N\tExecute only on GPU N\n");
-    printf("-c FILE\tUse FILE as compare kernel.  Default is %s\n",
-           COMPARE_KERNEL);
+    printf("-c FILE\tUse FILE as compare kernel instead of the built-in one\n");
+    printf("--agent HOST:PORT\tStart with the other agents of the "
+           "--coordinator at HOST:PORT and report to it\n");
+    printf("--baseline FILE\tFlag GPUs slower than the throughput FILE has "
+           "for their model, or than their peers, and add new models to "
+           "it\n");
+    printf("--baseline-update\tRecord this run's throughput in the "
+           "--baseline even for models it has\n");
+    printf("--blocking-sync\tSleep until the GPU is done instead of polling "
+           "it\n");
+    printf("--coordinator PORT\tDon't burn, start the agents that connect to "
+           "PORT together and report on the cluster\n");
+    printf("--compare K\tCompare kernel, scalar, vector or checksum (column "
+           "sums against a reference from A and B).  Default is scalar\n");
+    printf("--daemon PORT\tBurn until SIGTERM, and serve the counters of "
+           "the GPUs on http://:PORT/metrics for Prometheus\n");
+    printf("--engine E\tCompute the results with the cublas GEMM, or the "
+           "synthetic fma or mma (tensor core) loads\n");
+    printf("--fail-fast S\tStop a GPU at its first error (gpu), or all of "
+           "them (all).  The exit status has bit N set if GPU N failed\n");
+    printf("--graph\tCapture a round as a CUDA graph and replay it\n");
+    printf("--json-out FILE\tWrite a JSON record per GPU and report to "
+           "FILE\n");
+    printf("--latency\tTime each GEMM and compare on the GPU, and print "
+           "their p50, p99 and max per GPU\n");
+    printf("--mem P\tBurn the memory instead, with the walking, inversions or "
+           "random pattern\n");
+    printf("--mem-mix P\tBurn the memory next to the GEMMs\n");
+    printf("--mig\tBurn each MIG instance in a client of its own, only "
+           "those of GPU N with -i N\n");
+    printf("--mps N\tRun N clients on each GPU (or MIG instance), for "
+           "MPS.  They split its memory\n");
+    printf("--mps-pct P\tGive each client P%% of the SMs under MPS "
+           "(CUDA_MPS_ACTIVE_THREAD_PERCENTAGE)\n");
+    printf("--no-affinity\tLeave the workers on any CPU and NUMA node, "
+           "instead of the ones next to their GPU\n");
+    printf("--nodes N\tAgents the --coordinator waits for\n");
+    printf("--p2p P\tSend data between the GPUs during the burn, to the next "
+           "one (ring) or to all of them (all)\n");
+    printf("--pcie\tCopy data to the host and back next to the burn, "
+           "checking it, and report the GB/s each way\n");
+    printf("--pipeline\tCompare each result as soon as it is computed\n");
+    printf("--precision P\tfp64, fp32, tf32, fp16, bf16 or fp8.  Default is "
+           "fp32\n");
+    printf("--profile P\tStep the load: square:MS[:DUTY%%], ramp:MS or "
+           "burst:MS[:DUTY%%], the same on all GPUs\n");
+    printf("--sample-ms N\tRead the GPU sensors every N ms.  Default is %d\n",
+           DEFAULT_SAMPLE_MS);
+    printf("--slow-frac F\tSlow is below F of the --baseline or of the "
+           "peers.  Default is %.1f\n",
+           DEFAULT_SLOW_FRACTION);
+    printf("--size N\tMultiply N*N matrices.  Default is %lu\n", SIZE);
+    printf("--size MxNxK\tMultiply an MxK matrix with a KxN one\n");
+    printf("--stable-window S\tSeconds --until-stable looks back.  Default "
+           "is %d\n",
+           DEFAULT_STABLE_WINDOW);
+    printf("--streams N\tSpread the GEMMs over N streams.  Default is 1\n");
+    printf("--sweep M\tRun once per point of M, e.g. "
+           "\"size=4096,8192;precision=fp32,fp16;streams=1,2\" (size, "
+           "precision, streams, mem, compare or engine), for TIME each, and "
+           "print a table.  first_report_s is the time from the start of the "
+           "point to the slowest GPU's first report, init included\n");
+    printf("--sweep-out FILE\tWrite the --sweep table to FILE as CSV\n");
+    printf("--threads\tRun the GPUs in threads of one process instead of "
+           "forking\n");
+    printf("--until-stable PCT\tStop once the throughput of every GPU varies "
+           "by under PCT%% and its temperature is steady.  TIME is the "
+           "limit\n");
+    printf("--seed N\tSeed for the A and B matrices.  Default is %d\n",
+           DEFAULT_SEED);
     printf("-stts T\tSet timeout threshold to T seconds for using SIGTERM to abort child processes before using SIGKILL.  Default is %d\n",
            SIGTERM_TIMEOUT_THRESHOLD_SECS);
     printf("-h\tShow this help message\n\n");
@@ -810,18 +4666,569 @@ ssize_t decodeUSEMEM(const char *s) {
     return (*s2 == 0) ? r * 1024 * 1024 : 0;
 }
 
+// Matches "--name VALUE" and "--name=VALUE" at argv[i].  Returns the value
+// (advancing i and thisParam past it), or NULL if argv[i] isn't --name.
+const char *longOption(int argc, char **argv, size_t &i, int &thisParam,
+                       const char *name) {
+    size_t len = strlen(name);
+    if (strncmp(argv[i], name, len))
+        return NULL;
+    if (argv[i][len] == '=') {
+        thisParam++;
+        return argv[i] + len + 1;
+    }
+    if (argv[i][len])
+        return NULL;
+    if (i + 1 >= (size_t)argc) {
+        fprintf(stderr, "Syntax error near %s\n", name);
+        exit(EINVAL);
+    }
+    thisParam += 2;
+    return argv[++i];
+}
+
+MemPattern decodeMemPattern(const char *s) {
+    for (int p = 0; p <= MEM_RANDOM; ++p)
+        if (!strcmp(s, g_memPatternNames[p]))
+            return (MemPattern)p;
+    fprintf(stderr, "Syntax error near --mem\n");
+    exit(EINVAL);
+}
+
+// square:PERIOD_MS[:DUTY%], ramp:PERIOD_MS or burst:PERIOD_MS[:DUTY%]
+bool decodeProfile(const char *s, LoadProfile &profile) {
+    int shape = 0;
+    size_t len = 0;
+    while (shape <= PROFILE_BURST &&
+           (len = strlen(g_profileNames[shape]),
+            strncmp(s, g_profileNames[shape], len) || s[len] != ':'))
+        ++shape;
+    if (shape > PROFILE_BURST)
+        return false;
+    double periodMs = 0.0, duty = 50.0;
+    int fields = sscanf(s + len + 1, "%lf:%lf", &periodMs, &duty);
+    if (fields < 1 || (shape == PROFILE_RAMP && fields > 1) ||
+        periodMs <= 0.0 || duty <= 0.0 || duty > 100.0)
+        return false;
+    profile.shape = (ProfileShape)shape;
+    profile.period = periodMs / 1000.0;
+    profile.duty = duty / 100.0;
+    return true;
+}
+
+// N          -- N*N matrices
+// MxNxK      -- C (MxN) = A (MxK) * B (KxN)
+// false      -- error
+bool decodeSize(const char *s, BurnConfig &config) {
+    size_t dims[3];
+    int count = 0;
+    for (;;) {
+        char *s2;
+        long long r = strtoll(s, &s2, 10);
+        if (s == s2 || r <= 0 || count == 3)
+            return false;
+        dims[count++] = r;
+        if (*s2 == 0)
+            break;
+        if (*s2 != 'x')
+            return false;
+        s = s2 + 1;
+    }
+    if (count == 2)
+        return false;
+    config.m = dims[0];
+    config.n = count == 3 ? dims[1] : dims[0];
+    config.k = count == 3 ? dims[2] : dims[0];
+    return true;
+}
+
+// --sweep: what the matrix may vary, and the option it's passed as
+const char *g_sweepKeys[][2] = {
+    {"size", "--size"},       {"precision", "--precision"},
+    {"streams", "--streams"}, {"mem", "-m"},
+    {"compare", "--compare"}, {"engine", "--engine"}};
+
+// A number of a --json-out record, fallback if it hasn't got the key
+double jsonNumber(const std::string &record, const char *key,
+                  double fallback = -1.0) {
+    size_t at = record.find(std::string("\"") + key + "\":");
+    if (at == std::string::npos)
+        return fallback;
+    const char *value = record.c_str() + at + strlen(key) + 3;
+    char *end;
+    double number = strtod(value, &end);
+    return end == value ? fallback : number;
+}
+
+// What a point of the sweep came to, over all GPUs
+struct SweepResult {
+    bool ran = false; // Got a summary
+    double gflops = 0.0, gbps = 0.0, power = 0.0;
+    // s from the fork to the slowest GPU's first report, which takes in
+    // the init and a whole first round, not just the first GEMM
+    double firstReport = 0.0;
+    long long errors = 0;
+};
+
+// Reads the --json-out of a point.  Like the summaries, the power and GB/s
+// leave out the first report of each GPU, which also covers its init.
+SweepResult readSweepPoint(const char *path, double start) {
+    SweepResult result;
+    std::map<int, std::vector<double> > power, gbps;
+    std::map<int, double> first;
+    std::ifstream f(path);
+    std::string record;
+    while (std::getline(f, record)) {
+        int gpu = (int)jsonNumber(record, "gpu");
+        if (gpu < 0)
+            continue;
+        if (record.find("\"summary\":true") != std::string::npos) {
+            result.ran = true;
+            result.gflops += std::max(jsonNumber(record, "gflops_mean"), 0.0);
+            result.errors += (long long)jsonNumber(record, "errors", 0.0);
+        } else if (record.compare(0, 6, "{\"ts\":") == 0) {
+            if (!first.count(gpu)) {
+                first[gpu] = jsonNumber(record, "ts") - start;
+                continue;
+            }
+            double watts = jsonNumber(record, "power_w");
+            if (watts >= 0.0)
+                power[gpu].push_back(watts);
+            double memory = jsonNumber(record, "gbps");
+            if (memory >= 0.0)
+                gbps[gpu].push_back(memory);
+        }
+    }
+    for (std::map<int, double>::iterator it = first.begin(); it != first.end();
+         ++it)
+        result.firstReport = std::max(result.firstReport, it->second);
+    for (std::map<int, std::vector<double> >::iterator it = power.begin();
+         it != power.end(); ++it)
+        result.power += std::accumulate(it->second.begin(), it->second.end(),
+                                        0.0) /
+                        it->second.size();
+    for (std::map<int, std::vector<double> >::iterator it = gbps.begin();
+         it != gbps.end(); ++it)
+        result.gbps += std::accumulate(it->second.begin(), it->second.end(),
+                                       0.0) /
+                       it->second.size();
+    return result;
+}
+
+// Runs gpu_burn once per point of the --sweep matrix, with the options of
+// this run (argv up to optionsEnd, less the --sweep and --json-out ones)
+// and then the point's, for runLength seconds each.  The table goes to
+// stdout, --sweep-out as CSV and --json-out as a record per point.
+int runSweep(char **argv, int optionsEnd, const BurnConfig &config,
+             int runLength) {
+    // key=v1,v2;key=v1...
+    std::vector<std::string> keys, options;
+    std::vector<std::vector<std::string> > values;
+    std::stringstream spec(config.sweep);
+    std::string dimension;
+    while (std::getline(spec, dimension, ';')) {
+        size_t eq = dimension.find('=');
+        size_t k = 0;
+        while (k < sizeof(g_sweepKeys) / sizeof(g_sweepKeys[0]) &&
+               (eq == std::string::npos ||
+                dimension.compare(0, eq, g_sweepKeys[k][0])))
+            ++k;
+        if (k == sizeof(g_sweepKeys) / sizeof(g_sweepKeys[0])) {
+            fprintf(stderr, "Syntax error near --sweep: %s\n",
+                    dimension.c_str());
+            exit(EINVAL);
+        }
+        keys.push_back(g_sweepKeys[k][0]);
+        options.push_back(g_sweepKeys[k][1]);
+        values.push_back(std::vector<std::string>());
+        std::stringstream list(dimension.substr(eq + 1));
+        std::string value;
+        while (std::getline(list, value, ','))
+            if (!value.empty())
+                values.back().push_back(value);
+        if (values.back().empty()) {
+            fprintf(stderr, "Syntax error near --sweep: %s\n",
+                    dimension.c_str());
+            exit(EINVAL);
+        }
+    }
+
+    std::vector<std::string> base;
+    for (int i = 1; i < optionsEnd; ++i) {
+        const char *skipped[] = {"--sweep", "--sweep-out", "--json-out"};
+        bool skip = false;
+        for (size_t s = 0; s < 3; ++s) {
+            size_t len = strlen(skipped[s]);
+            if (strncmp(argv[i], skipped[s], len))
+                continue;
+            if (!argv[i][len]) {
+                skip = true;
+                ++i; // And its value
+                break;
+            }
+            if (argv[i][len] == '=') {
+                skip = true;
+                break;
+            }
+        }
+        if (!skip)
+            base.push_back(argv[i]);
+    }
+
+    size_t points = 1;
+    for (size_t d = 0; d < values.size(); ++d)
+        points *= values.at(d).size();
+    printf("Sweeping %zu points of %d s\n", points, runLength);
+
+    FILE *csv = config.sweepOut ? fopen(config.sweepOut, "w") : NULL;
+    if (config.sweepOut && !csv) {
+        fprintf(stderr, "Couldn't write %s: %s\n", config.sweepOut,
+                strerror(errno));
+        exit(EIO);
+    }
+    FILE *json = openJson(config.jsonOut);
+    std::string header;
+    for (size_t d = 0; d < keys.size(); ++d)
+        header += keys.at(d) + ",";
+    header += "gflops,gbps,power_w,gflops_per_w,first_report_s,errors,status";
+    if (csv)
+        fprintf(csv, "%s\n", header.c_str());
+    printf("%s\n", header.c_str());
+
+    int status = 0;
+    for (size_t p = 0; p < points; ++p) {
+        // The last dimension steps first, as in nested loops
+        std::vector<std::string> point(values.size());
+        for (size_t d = values.size(), rest = p; d-- > 0;) {
+            point.at(d) = values.at(d).at(rest % values.at(d).size());
+            rest /= values.at(d).size();
+        }
+        std::vector<std::string> args(base);
+        for (size_t d = 0; d < point.size(); ++d) {
+            args.push_back(options.at(d));
+            args.push_back(point.at(d));
+        }
+        char path[] = "/tmp/gpu_burn_sweep_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd == -1) {
+            fprintf(stderr, "Couldn't create a sweep file: %s\n",
+                    strerror(errno));
+            exit(EIO);
+        }
+        close(fd);
+        char seconds[16];
+        snprintf(seconds, sizeof(seconds), "%d", runLength);
+        args.push_back("--json-out");
+        args.push_back(path);
+        args.push_back(seconds);
+
+        double start = getTime();
+        pid_t pid = fork();
+        if (!pid) {
+            // Only the table is worth reading, the errors still come through
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+            std::vector<char *> childArgs(1, argv[0]);
+            for (size_t a = 0; a < args.size(); ++a)
+                childArgs.push_back((char *)args.at(a).c_str());
+            childArgs.push_back(NULL);
+            execv("/proc/self/exe", childArgs.data());
+            fprintf(stderr, "Couldn't run %s: %s\n", argv[0],
+                    strerror(errno));
+            _exit(ENOENT);
+        }
+        int childStatus = 0;
+        waitpid(pid, &childStatus, 0);
+        SweepResult r = readSweepPoint(path, start);
+        unlink(path);
+
+        const char *state = !r.ran       ? "FAILED"
+                            : r.errors   ? "FAULTY"
+                                         : "OK";
+        if (strcmp(state, "OK"))
+            status = 1;
+        char row[256];
+        snprintf(row, sizeof(row), "%.1f,%.1f,%.1f,%.2f,%.1f,%lld,%s",
+                 r.gflops, r.gbps, r.power,
+                 r.power > 0.0 ? r.gflops / r.power : 0.0, r.firstReport,
+                 r.errors, state);
+        std::string line;
+        for (size_t d = 0; d < point.size(); ++d)
+            line += point.at(d) + ",";
+        line += row;
+        printf("%s\n", line.c_str());
+        fflush(stdout);
+        if (csv) {
+            fprintf(csv, "%s\n", line.c_str());
+            fflush(csv);
+        }
+        if (json) {
+            fprintf(json, "{\"sweep\":true");
+            for (size_t d = 0; d < point.size(); ++d)
+                fprintf(json, ",\"%s\":\"%s\"", keys.at(d).c_str(),
+                        point.at(d).c_str());
+            fprintf(json,
+                    ",\"gflops\":%.1f,\"gbps\":%.1f,\"power_w\":%.1f,"
+                    "\"first_report_s\":%.1f,\"errors\":%lld,"
+                    "\"status\":\"%s\"}\n",
+                    r.gflops, r.gbps, r.power, r.firstReport, r.errors, state);
+            fflush(json);
+        }
+    }
+    if (csv)
+        fclose(csv);
+    if (json)
+        fclose(json);
+    return status;
+}
+
 int main(int argc, char **argv) {
     int runLength = 10;
-    bool useDoubles = false;
-    bool useTensorCores = false;
+    BurnConfig config;
     int thisParam = 0;
-    ssize_t useBytes = 0; // 0 == use USEMEM% of free mem
     int device_id = -1;
-    char *kernelFile = (char *)COMPARE_KERNEL;
     std::chrono::seconds sigterm_timeout_threshold_secs = std::chrono::seconds(SIGTERM_TIMEOUT_THRESHOLD_SECS);
 
     std::vector<std::string> args(argv, argv + argc);
     for (size_t i = 1; i < args.size(); ++i) {
+        // Long options first, the short ones below match on substrings
+        const char *value;
+        if ((value = longOption(argc, argv, i, thisParam, "--seed"))) {
+            config.seed = strtoull(value, NULL, 0);
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--precision"))) {
+            int p = 0;
+            while (p <= FP8 && strcmp(value, g_precisionNames[p]))
+                ++p;
+            if (p > FP8) {
+                fprintf(stderr, "Syntax error near --precision\n");
+                exit(EINVAL);
+            }
+#if CUDA_VERSION < 12000
+            if (p == FP8) {
+                fprintf(stderr, "FP8 needs to be built with CUDA 12 or later\n");
+                exit(EINVAL);
+            }
+#endif
+            config.precision = (Precision)p;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--size"))) {
+            if (!decodeSize(value, config)) {
+                fprintf(stderr, "Syntax error near --size\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--sample-ms"))) {
+            config.sampleMs = atoi(value);
+            if (config.sampleMs < 1) {
+                fprintf(stderr, "Syntax error near --sample-ms\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--json-out"))) {
+            config.jsonOut = value;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--streams"))) {
+            config.streams = atoi(value);
+            if (config.streams < 1) {
+                fprintf(stderr, "Syntax error near --streams\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            config.threads = true;
+            thisParam++;
+            continue;
+        }
+        if (strcmp(argv[i], "--graph") == 0) {
+            config.graph = true;
+            thisParam++;
+            continue;
+        }
+        if (strcmp(argv[i], "--pipeline") == 0) {
+            config.pipelined = true;
+            thisParam++;
+            continue;
+        }
+        if (strcmp(argv[i], "--blocking-sync") == 0) {
+            config.blockingSync = true;
+            thisParam++;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--mem"))) {
+            config.memPattern = decodeMemPattern(value);
+            config.memOnly = true;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--mem-mix"))) {
+            config.memPattern = decodeMemPattern(value);
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--until-stable"))) {
+            config.untilStable = atof(value);
+            if (config.untilStable <= 0.0) {
+                fprintf(stderr, "Syntax error near --until-stable\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--stable-window"))) {
+            config.stableWindow = atoi(value);
+            if (config.stableWindow < 1) {
+                fprintf(stderr, "Syntax error near --stable-window\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--baseline"))) {
+            config.baseline = value;
+            continue;
+        }
+        if (strcmp(argv[i], "--baseline-update") == 0) {
+            config.baselineUpdate = true;
+            thisParam++;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--slow-frac"))) {
+            config.slowFraction = atof(value);
+            if (config.slowFraction <= 0.0 || config.slowFraction > 1.0) {
+                fprintf(stderr, "Syntax error near --slow-frac\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--fail-fast"))) {
+            if (!strcmp(value, "gpu"))
+                config.failFast = FAIL_FAST_GPU;
+            else if (!strcmp(value, "all"))
+                config.failFast = FAIL_FAST_ALL;
+            else {
+                fprintf(stderr, "Syntax error near --fail-fast\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--no-affinity") == 0) {
+            config.affinity = false;
+            thisParam++;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--profile"))) {
+            if (!decodeProfile(value, config.profile)) {
+                fprintf(stderr, "Syntax error near --profile\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--coordinator"))) {
+            config.coordinatorPort = atoi(value);
+            if (config.coordinatorPort < 1 || config.coordinatorPort > 65535) {
+                fprintf(stderr, "Syntax error near --coordinator\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--nodes"))) {
+            config.clusterNodes = atoi(value);
+            if (config.clusterNodes < 1) {
+                fprintf(stderr, "Syntax error near --nodes\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--sweep-out"))) {
+            config.sweepOut = value;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--sweep"))) {
+            config.sweep = value;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--daemon"))) {
+            config.daemonPort = atoi(value);
+            if (config.daemonPort < 1 || config.daemonPort > 65535) {
+                fprintf(stderr, "Syntax error near --daemon\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--agent"))) {
+            config.agent = value;
+            continue;
+        }
+        if (strcmp(argv[i], "--latency") == 0) {
+            config.latency = true;
+            thisParam++;
+            continue;
+        }
+        if (strcmp(argv[i], "--pcie") == 0) {
+            config.pcie = true;
+            thisParam++;
+            continue;
+        }
+        if (strcmp(argv[i], "--mig") == 0) {
+            config.mig = true;
+            thisParam++;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--mps"))) {
+            config.mpsClients = atoi(value);
+            if (config.mpsClients < 1) {
+                fprintf(stderr, "Syntax error near --mps\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--mps-pct"))) {
+            config.mpsPercent = atoi(value);
+            if (config.mpsPercent < 1 || config.mpsPercent > 100) {
+                fprintf(stderr, "Syntax error near --mps-pct\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--p2p"))) {
+            if (!strcmp(value, g_p2pPatternNames[P2P_RING]))
+                config.p2p = P2P_RING;
+            else if (!strcmp(value, g_p2pPatternNames[P2P_ALL]))
+                config.p2p = P2P_ALL;
+            else {
+                fprintf(stderr, "Syntax error near --p2p\n");
+                exit(EINVAL);
+            }
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--engine"))) {
+            int e = 0;
+            while (e <= ENGINE_MMA && strcmp(value, g_engineNames[e]))
+                ++e;
+            if (e > ENGINE_MMA) {
+                fprintf(stderr, "Syntax error near --engine\n");
+                exit(EINVAL);
+            }
+            config.engine = (Engine)e;
+            continue;
+        }
+        if ((value = longOption(argc, argv, i, thisParam, "--compare"))) {
+            if (strcmp(value, "vector") && strcmp(value, "scalar") &&
+                strcmp(value, "checksum")) {
+                fprintf(stderr, "Syntax error near --compare\n");
+                exit(EINVAL);
+            }
+            config.vectorCompare = strcmp(value, "vector") == 0;
+            config.checksumCompare = strcmp(value, "checksum") == 0;
+            continue;
+        }
+        if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EINVAL);
+        }
         if (argc >= 2 && std::string(argv[i]).find("-h") != std::string::npos) {
             showHelp();
             return 0;
@@ -845,12 +5252,12 @@ int main(int argc, char **argv) {
             return 0;
         }
         if (argc >= 2 && std::string(argv[i]).find("-d") != std::string::npos) {
-            useDoubles = true;
+            config.precision = FP64;
             thisParam++;
         }
         if (argc >= 2 &&
             std::string(argv[i]).find("-tc") != std::string::npos) {
-            useTensorCores = true;
+            config.tensors = true;
             thisParam++;
         }
         if (argc >= 2 && strncmp(argv[i], "-m", 2) == 0) {
@@ -859,16 +5266,16 @@ int main(int argc, char **argv) {
             // -mNNN[%]
             // -m NNN[%]
             if (argv[i][2]) {
-                useBytes = decodeUSEMEM(argv[i] + 2);
+                config.useBytes = decodeUSEMEM(argv[i] + 2);
             } else if (i + 1 < args.size()) {
                 i++;
                 thisParam++;
-                useBytes = decodeUSEMEM(argv[i]);
+                config.useBytes = decodeUSEMEM(argv[i]);
             } else {
                 fprintf(stderr, "Syntax error near -m\n");
                 exit(EINVAL);
             }
-            if (useBytes == 0) {
+            if (config.useBytes == 0) {
                 fprintf(stderr, "Syntax error near -m\n");
                 exit(EINVAL);
             }
@@ -891,7 +5298,7 @@ int main(int argc, char **argv) {
             thisParam++;
 
             if (argv[i + 1]) {
-                kernelFile = argv[i + 1];
+                config.kernelFile = argv[i + 1];
                 thisParam++;
             }
         }
@@ -905,19 +5312,126 @@ int main(int argc, char **argv) {
         }
     }
 
+    // It doesn't burn, it collects what the agents report
+    if (config.coordinatorPort) {
+        if (!config.clusterNodes) {
+            fprintf(stderr, "--coordinator needs --nodes\n");
+            exit(EINVAL);
+        }
+        return coordinate(config);
+    }
+
     if (argc - thisParam < 2)
         printf("Run length not specified in the command line. ");
     else
         runLength = atoi(argv[1 + thisParam]);
-    printf("Using compare file: %s\n", kernelFile);
-    printf("Burning for %d seconds.\n", runLength);
-
-    if (useDoubles)
-        launch<double>(runLength, useDoubles, useTensorCores, useBytes,
-                       device_id, kernelFile, sigterm_timeout_threshold_secs);
+    // Each point is a run of its own
+    if (config.sweep) {
+        if (config.daemonPort || config.agent) {
+            fprintf(stderr, "--sweep can't be used with --daemon or "
+                            "--agent\n");
+            exit(EINVAL);
+        }
+        return runSweep(argv, 1 + thisParam, config, runLength);
+    }
+    if (config.kernelFile)
+        printf("Using compare file: %s\n", config.kernelFile);
     else
-        launch<float>(runLength, useDoubles, useTensorCores, useBytes,
-                      device_id, kernelFile, sigterm_timeout_threshold_secs);
+        printf("Using the built-in compare kernels\n");
+    // Each client only sees its MIG instance, and MPS shares a GPU between
+    // processes
+    bool shared = config.mig || config.mpsClients > 1 || config.mpsPercent;
+    if (shared && config.p2p != P2P_NONE) {
+        fprintf(stderr, "--p2p can't be used with --mig or --mps\n");
+        exit(EINVAL);
+    }
+    if (shared && config.threads) {
+        printf("--mig and --mps fork a process per client, not using "
+               "--threads\n");
+        config.threads = false;
+    }
+    // The engines have kernels for FP32 and FP64, and their own answer to
+    // check against rather than a GEMM's
+    if (config.engine == ENGINE_FMA && config.precision != FP32 &&
+        config.precision != FP64) {
+        fprintf(stderr, "--engine fma runs in fp32 or fp64\n");
+        exit(EINVAL);
+    }
+    if (config.engine == ENGINE_MMA && config.precision != FP32) {
+        fprintf(stderr, "--engine mma multiplies fp16 into fp32 results, "
+                        "leave --precision at fp32\n");
+        exit(EINVAL);
+    }
+    if (config.engine != ENGINE_CUBLAS && config.checksumCompare) {
+        fprintf(stderr, "--compare checksum works out a GEMM's sums, it "
+                        "can't be used with --engine\n");
+        exit(EINVAL);
+    }
+    // A graph replays the whole round, it has no calls in between to time
+    if (config.latency && config.graph) {
+        printf("--latency can't time the GEMMs of a --graph, leaving it "
+               "out\n");
+        config.latency = false;
+    }
+    // ...or to hold back
+    if (config.profile.shape != PROFILE_FLAT && config.graph) {
+        printf("--profile needs to issue each GEMM, not using --graph\n");
+        config.graph = false;
+    }
+    // All workers step the load from here on, and the agents of a
+    // --coordinator from when it starts them
+    config.profile.epoch = monotonicTime();
+    config.profile.seed = config.seed;
+    if (config.agent) {
+        double start;
+        config.agentFd = joinCoordinator(config.agent, start);
+        double wait = start - getTime();
+        if (wait > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        config.profile.epoch = monotonicTime() - (getTime() - start);
+    }
+    // The GPUs have to see each other's contexts and buffers
+    if (config.p2p != P2P_NONE && !config.threads) {
+        printf("--p2p runs the GPUs in threads (--threads)\n");
+        config.threads = true;
+    }
+    // Metrics on a port in use would go missing for days
+    if (config.daemonPort) {
+        config.metrics = new MetricsServer;
+        if (!config.metrics->listen(config.daemonPort)) {
+            fprintf(stderr, "Couldn't listen on port %d\n", config.daemonPort);
+            exit(EADDRINUSE);
+        }
+        printf("Burning until stopped, metrics on port %d.\n",
+               config.daemonPort);
+    } else
+        printf("Burning for %d seconds.\n", runLength);
+
+    int status;
+    switch (config.precision) {
+    case FP64:
+        status = launch<double>(runLength, config, device_id,
+                                sigterm_timeout_threshold_secs);
+        break;
+    case FP16:
+        status = launch<__half>(runLength, config, device_id,
+                                sigterm_timeout_threshold_secs);
+        break;
+    case BF16:
+        status = launch<__nv_bfloat16>(runLength, config, device_id,
+                                       sigterm_timeout_threshold_secs);
+        break;
+#if CUDA_VERSION >= 12000
+    case FP8:
+        status = launch<__nv_fp8_e4m3>(runLength, config, device_id,
+                                       sigterm_timeout_threshold_secs);
+        break;
+#endif
+    default:
+        status = launch<float>(runLength, config, device_id,
+                               sigterm_timeout_threshold_secs);
+    }
 
-    return 0;
+    // Without --fail-fast or --baseline the errors are only reported
+    return config.failFast != FAIL_FAST_OFF || config.baseline ? status : 0;
 }
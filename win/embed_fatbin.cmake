@@ -0,0 +1,7 @@
+# Turns the fatbin into a C array for gpu_burn-drv.cpp, since MSVC can't
+# link raw binaries in.  Run with -DINPUT=<fatbin> -DOUTPUT=<header>.
+file(READ "${INPUT}" hex HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+file(WRITE "${OUTPUT}"
+    "// Generated from compare.cu by embed_fatbin.cmake, do not edit\n"
+    "alignas(8) static const unsigned char compare_fatbin[] = {${bytes}};\n")